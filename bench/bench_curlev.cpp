@@ -0,0 +1,443 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+// Benchmark of curlev against an embedded loopback HTTP/1.1 or h2c server.
+//
+// Usage: bench_curlev [--requests=1000,10000,100000] [--modes=exec,start_join,launch,threaded,unthreaded]
+//                     [--loops=1] [--callback-threads=1] [--protocol=http1|h2c] [--streams=100]
+//
+// With h2c, the requests are multiplexed: they wait for a connection to
+// multiplex on (pipewait), with at most --streams requests per connection.
+//
+// The server and each benchmark run in their own process, so that
+// the CPU usage and the peak RSS are those of the measured configuration.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <uv.h>
+#include <vector>
+
+#include "async.hpp"
+#include "http.hpp"
+#include "loopback_server.hpp"
+
+using namespace curlev;
+
+namespace
+{
+
+  struct config
+  {
+    std::vector< size_t >      requests         = { 1'000, 10'000, 100'000 };
+    std::vector< std::string > modes            = { "exec", "start_join", "launch", "threaded", "unthreaded" };
+    unsigned                   loops            = 1;
+    unsigned                   callback_threads = 1;
+    std::string                protocol         = "http1";
+    unsigned                   streams          = 100;
+  };
+
+  struct result
+  {
+    uint64_t                start_ns = 0;  // duration of the starting phase
+    uint64_t                total_ns = 0;  // duration until all requests are finished
+    std::vector< uint64_t > latencies_ns;  // per request, if measurable
+    size_t                  errors   = 0;  // requests not returning 200
+  };
+
+  //--------------------------------------------------------------------
+  // Split a comma separated list
+  std::vector< std::string > split( const std::string & p_list )
+  {
+    std::vector< std::string > items;
+    std::istringstream         stream( p_list );
+    //
+    for ( std::string item; std::getline( stream, item, ',' ); )
+      if ( ! item.empty() )
+        items.push_back( item );
+    //
+    return items;
+  }
+
+  //--------------------------------------------------------------------
+  bool parse_arguments( int p_argc, char ** p_argv, config & p_config )
+  {
+    for ( int i = 1; i < p_argc; i++ )
+    {
+      std::string argument = p_argv[ i ];
+      auto        equal    = argument.find( '=' );
+      auto        key      = argument.substr( 0, equal );
+      auto        value    = equal == std::string::npos ? "" : argument.substr( equal + 1 );
+      //
+      if ( key == "--requests" )
+      {
+        p_config.requests.clear();
+        for ( const auto & item : split( value ) )
+          p_config.requests.push_back( std::stoul( item ) );
+      }
+      else if ( key == "--modes" )
+        p_config.modes = split( value );
+      else if ( key == "--loops" )
+        p_config.loops = std::stoul( value );
+      else if ( key == "--callback-threads" )
+        p_config.callback_threads = std::stoul( value );
+      else if ( key == "--protocol" )
+        p_config.protocol = value;
+      else if ( key == "--streams" )
+        p_config.streams = std::stoul( value );
+      else
+        return false;
+    }
+    //
+#ifndef BENCH_HAVE_NGHTTP2
+    if ( p_config.protocol == "h2c" )
+    {
+      std::fprintf( stderr, "h2c is not available, nghttp2 was not found\n" );
+      return false;
+    }
+#endif
+    //
+    return ! p_config.requests.empty() && ! p_config.modes.empty() &&
+           ( p_config.protocol == "http1" || p_config.protocol == "h2c" );
+  }
+
+  //--------------------------------------------------------------------
+  // Counts finished requests, and wakes up the waiting thread once all are done
+  class completion
+  {
+  public:
+    explicit completion( size_t p_expected ) : m_expected( p_expected ) {}
+    //
+    void done()
+    {
+      if ( ++m_done == m_expected )
+      {
+        std::lock_guard lock( m_mutex );
+        m_cv.notify_one();
+      }
+    }
+    //
+    void wait()
+    {
+      std::unique_lock lock( m_mutex );
+      m_cv.wait( lock, [ this ] { return m_done == m_expected; } );
+    }
+    //
+  private:
+    size_t                  m_expected;
+    std::atomic_size_t      m_done = 0;
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+  };
+
+  //--------------------------------------------------------------------
+  // When the completion time is not known, the latency is
+  // the queuing and transfer durations
+  uint64_t latency_ns( const timings & p_timings )
+  {
+    return ( p_timings.queue + p_timings.total ) * 1'000;
+  }
+
+  //--------------------------------------------------------------------
+  // Sequential synchronous requests
+  result run_exec( ASync & p_async, const std::string & p_url, size_t p_requests )
+  {
+    result res;
+    res.latencies_ns.reserve( p_requests );
+    //
+    auto start = uv_hrtime();
+    //
+    for ( size_t i = 0; i < p_requests; i++ )
+    {
+      auto begin = uv_hrtime();
+      auto http  = HTTP::create( p_async );
+      //
+      if ( http->GET( p_url ).exec().get_code() != 200 )
+        res.errors++;
+      //
+      res.latencies_ns.push_back( uv_hrtime() - begin );
+    }
+    //
+    res.start_ns = uv_hrtime() - start;
+    res.total_ns = res.start_ns;
+    //
+    return res;
+  }
+
+  //--------------------------------------------------------------------
+  // All requests started, then joined
+  result run_start_join( ASync & p_async, const std::string & p_url, size_t p_requests )
+  {
+    result                                 res;
+    std::vector< std::shared_ptr< HTTP > > https;
+    https.reserve( p_requests );
+    res.latencies_ns.reserve( p_requests );
+    //
+    auto start = uv_hrtime();
+    //
+    for ( size_t i = 0; i < p_requests; i++ )
+    {
+      https.emplace_back( HTTP::create( p_async ) );
+      https.back()->GET( p_url ).start();
+    }
+    //
+    res.start_ns = uv_hrtime() - start;
+    //
+    for ( auto & http : https )
+    {
+      if ( http->join().get_code() != 200 )
+        res.errors++;
+      //
+      res.latencies_ns.push_back( latency_ns( http->get_timings() ) );
+    }
+    //
+    res.total_ns = uv_hrtime() - start;
+    //
+    return res;
+  }
+
+  //--------------------------------------------------------------------
+  // All requests launched, then their futures waited
+  result run_launch( ASync & p_async, const std::string & p_url, size_t p_requests )
+  {
+    result                                       res;
+    std::vector< std::future< HTTP::response > > futures;
+    futures.reserve( p_requests );
+    res.latencies_ns.reserve( p_requests );
+    //
+    auto start = uv_hrtime();
+    //
+    for ( size_t i = 0; i < p_requests; i++ )
+      futures.emplace_back( HTTP::create( p_async )->GET( p_url ).launch() );
+    //
+    res.start_ns = uv_hrtime() - start;
+    //
+    for ( auto & future : futures )
+    {
+      auto response = future.get();
+      //
+      if ( response.code != 200 )
+        res.errors++;
+      //
+      res.latencies_ns.push_back( latency_ns( response.timings ) );
+    }
+    //
+    res.total_ns = uv_hrtime() - start;
+    //
+    return res;
+  }
+
+  //--------------------------------------------------------------------
+  // All requests started with a callback, the HTTP objects are not kept
+  result run_callback( ASync & p_async, const std::string & p_url, size_t p_requests, bool p_threaded )
+  {
+    result                  res;
+    completion              finished( p_requests );
+    std::atomic_size_t      errors = 0;
+    std::vector< uint64_t > started_ns( p_requests );
+    //
+    res.latencies_ns.resize( p_requests );
+    //
+    auto start = uv_hrtime();
+    //
+    for ( size_t i = 0; i < p_requests; i++ )
+    {
+      started_ns[ i ] = uv_hrtime();
+      //
+      HTTP::create( p_async )
+          ->GET( p_url )
+          .threaded_callback( p_threaded )
+          .start(
+              [ &, i ]( const HTTP & p_http )
+              {
+                res.latencies_ns[ i ] = uv_hrtime() - started_ns[ i ];
+                //
+                if ( p_http.get_code() != 200 )
+                  errors++;
+                //
+                finished.done();
+              } );
+    }
+    //
+    res.start_ns = uv_hrtime() - start;
+    //
+    finished.wait();
+    //
+    res.total_ns = uv_hrtime() - start;
+    res.errors   = errors;
+    //
+    return res;
+  }
+
+  //--------------------------------------------------------------------
+  uint64_t percentile_us( std::vector< uint64_t > & p_values, unsigned p_percent )
+  {
+    if ( p_values.empty() )
+      return 0;
+    //
+    auto index = std::min( p_values.size() - 1, p_values.size() * p_percent / 100 );
+    std::nth_element( p_values.begin(), p_values.begin() + index, p_values.end() );
+    //
+    return p_values[ index ] / 1'000;
+  }
+
+  //--------------------------------------------------------------------
+  uint64_t cpu_time_us()
+  {
+    rusage usage = {};
+    getrusage( RUSAGE_SELF, &usage );
+    //
+    return ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1'000'000ULL +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  }
+
+  //--------------------------------------------------------------------
+  // Executed in a child process: run a benchmark and print its result line
+  int run_benchmark( const config & p_config, const std::string & p_url, const std::string & p_mode, size_t p_requests )
+  {
+    ASync async;
+    //
+    if ( p_config.protocol == "h2c" &&
+         ! async.multi_options( "multiplex=1,max_concurrent_streams=" + std::to_string( p_config.streams ) ) )
+      return EXIT_FAILURE;
+    //
+    if ( ! async.start( p_config.loops, p_config.callback_threads ) )
+      return EXIT_FAILURE;
+    //
+    if ( p_config.protocol == "h2c" && ! async.options( "http_version=2prior,pipewait=1" ) )
+      return EXIT_FAILURE;
+    //
+    auto   cpu_start = cpu_time_us();
+    result res;
+    //
+    if      ( p_mode == "exec"       ) res = run_exec      ( async, p_url, p_requests );
+    else if ( p_mode == "start_join" ) res = run_start_join( async, p_url, p_requests );
+    else if ( p_mode == "launch"     ) res = run_launch    ( async, p_url, p_requests );
+    else if ( p_mode == "threaded"   ) res = run_callback  ( async, p_url, p_requests, true  );
+    else if ( p_mode == "unthreaded" ) res = run_callback  ( async, p_url, p_requests, false );
+    else
+      return EXIT_FAILURE;
+    //
+    auto cpu_us = cpu_time_us() - cpu_start;
+    //
+    async.stop();
+    //
+    rusage usage = {};
+    getrusage( RUSAGE_SELF, &usage );
+    //
+    auto rate = []( size_t p_count, uint64_t p_ns ) { return p_ns == 0 ? 0.0 : p_count * 1e9 / p_ns; };
+    bool has_latency = ! res.latencies_ns.empty();
+    //
+    std::printf( "%-10s | %8zu | %11.0f | %11.0f | %8s | %8s | %4.0f%% | %10ld | %zu\n",
+                 p_mode.c_str(),
+                 p_requests,
+                 rate( p_requests, res.start_ns ),
+                 rate( p_requests, res.total_ns ),
+                 has_latency ? std::to_string( percentile_us( res.latencies_ns, 50 ) ).c_str() : "-",
+                 has_latency ? std::to_string( percentile_us( res.latencies_ns, 99 ) ).c_str() : "-",
+                 res.total_ns == 0 ? 0.0 : cpu_us * 100'000.0 / res.total_ns,
+                 usage.ru_maxrss,
+                 res.errors );
+    std::fflush( stdout );
+    //
+    return EXIT_SUCCESS;
+  }
+
+  //--------------------------------------------------------------------
+  // Many sockets may be opened simultaneously
+  void raise_file_limit()
+  {
+    rlimit limit = {};
+    //
+    if ( getrlimit( RLIMIT_NOFILE, &limit ) == 0 )
+    {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit( RLIMIT_NOFILE, &limit );
+    }
+  }
+
+} // namespace
+
+//--------------------------------------------------------------------
+int main( int argc, char ** argv )
+{
+  config cfg;
+  //
+  if ( ! parse_arguments( argc, argv, cfg ) )
+  {
+    std::fprintf( stderr, "Usage: %s [--requests=1000,10000,100000] [--modes=exec,start_join,launch,threaded,unthreaded]"
+                          " [--loops=1] [--callback-threads=1] [--protocol=http1|h2c] [--streams=100]\n", argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+  //
+  raise_file_limit();
+  //
+  uint16_t port   = 0;
+  int      socket = bench::open_listening_socket( port );
+  if ( socket < 0 )
+  {
+    std::perror( "listening socket" );
+    return EXIT_FAILURE;
+  }
+  //
+  pid_t server = fork();
+  if ( server == 0 )
+  {
+#ifdef BENCH_HAVE_NGHTTP2
+    if ( cfg.protocol == "h2c" )
+      bench::run_loopback_h2c_server( socket );
+#endif
+    bench::run_loopback_server( socket );
+  }
+  //
+  close( socket );
+  //
+  if ( server < 0 )
+  {
+    std::perror( "fork" );
+    return EXIT_FAILURE;
+  }
+  //
+  auto url    = "http://127.0.0.1:" + std::to_string( port ) + "/";
+  int  status = EXIT_SUCCESS;
+  //
+  std::printf( "curlev %s, %s, %u loop(s), %u callback thread(s)\n\n", curl_version(), cfg.protocol.c_str(), cfg.loops, cfg.callback_threads );
+  std::printf( "Mode       | Requests | Start req/s | Compl req/s | p50 (us) | p99 (us) |   CPU |   RSS (KB) | Errors\n" );
+  std::printf( "-----------|---------:|------------:|------------:|---------:|---------:|------:|-----------:|------:\n" );
+  std::fflush( stdout );
+  //
+  for ( const auto & mode : cfg.modes )
+    for ( auto requests : cfg.requests )
+    {
+      pid_t child = fork();
+      //
+      if ( child == 0 )
+        _exit( run_benchmark( cfg, url, mode, requests ) );
+      //
+      int child_status = 0;
+      if ( child < 0 || waitpid( child, &child_status, 0 ) != child ||
+           ! WIFEXITED( child_status ) || WEXITSTATUS( child_status ) != EXIT_SUCCESS )
+      {
+        std::fprintf( stderr, "%s with %zu requests failed\n", mode.c_str(), requests );
+        status = EXIT_FAILURE;
+      }
+    }
+  //
+  kill( server, SIGTERM );
+  waitpid( server, nullptr, 0 );
+  //
+  return status;
+}
@@ -0,0 +1,206 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <nghttp2/nghttp2.h>
+#include <string>
+#include <uv.h>
+
+#include "loopback_server.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+  constexpr int         c_backlog         = 4096;
+  constexpr size_t      c_read_buffer_max = 64 * 1024;
+  constexpr uint32_t    c_max_streams     = 1000;
+  constexpr const char  c_body[]          = "OK";
+  //
+  struct connection
+  {
+    uv_tcp_t           handle;
+    nghttp2_session *  session = nullptr;
+    std::string        output; // frames produced by nghttp2, not yet written
+  };
+
+  //--------------------------------------------------------------------
+  void on_close( uv_handle_t * p_handle )
+  {
+    auto * conn = static_cast< connection * >( p_handle->data );
+    //
+    nghttp2_session_del( conn->session ); // ok on nullptr
+    delete conn;
+  }
+
+  //--------------------------------------------------------------------
+  void on_write( uv_write_t * p_request, int /* p_status */ )
+  {
+    delete static_cast< std::string * >( p_request->data );
+    delete p_request;
+  }
+
+  //--------------------------------------------------------------------
+  void on_alloc( uv_handle_t * /* p_handle */, size_t /* p_suggested_size */, uv_buf_t * p_buffer )
+  {
+    static thread_local char buffer[ c_read_buffer_max ]; // data is consumed in on_read
+    //
+    *p_buffer = uv_buf_init( buffer, sizeof( buffer ) );
+  }
+
+  //--------------------------------------------------------------------
+  nghttp2_nv header( const char * p_name, const char * p_value )
+  {
+    return { const_cast< uint8_t * >( reinterpret_cast< const uint8_t * >( p_name  ) ),
+             const_cast< uint8_t * >( reinterpret_cast< const uint8_t * >( p_value ) ),
+             std::strlen( p_name ),
+             std::strlen( p_value ),
+             NGHTTP2_NV_FLAG_NONE };
+  }
+
+  //--------------------------------------------------------------------
+  // nghttp2 callbacks
+
+  ssize_t on_send( nghttp2_session * /* p_session */, const uint8_t * p_data, size_t p_length, int /* p_flags */, void * p_user_data )
+  {
+    static_cast< connection * >( p_user_data )->output.append( reinterpret_cast< const char * >( p_data ), p_length );
+    //
+    return static_cast< ssize_t >( p_length );
+  }
+
+  ssize_t on_read_body(
+      nghttp2_session *     /* p_session */,
+      int32_t               /* p_stream_id */,
+      uint8_t *             p_buffer,
+      size_t                /* p_length */,
+      uint32_t *            p_data_flags,
+      nghttp2_data_source * /* p_source */,
+      void *                /* p_user_data */ )
+  {
+    std::memcpy( p_buffer, c_body, sizeof( c_body ) - 1 );
+    *p_data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    //
+    return sizeof( c_body ) - 1;
+  }
+
+  // Answer when the request is complete (headers, and body if any)
+  int on_frame_recv( nghttp2_session * p_session, const nghttp2_frame * p_frame, void * /* p_user_data */ )
+  {
+    if ( ( p_frame->hd.type == NGHTTP2_HEADERS || p_frame->hd.type == NGHTTP2_DATA ) &&
+         ( p_frame->hd.flags & NGHTTP2_FLAG_END_STREAM ) != 0 )
+    {
+      const nghttp2_nv headers[] = { header( ":status", "200" ), header( "content-type", "text/plain" ) };
+      //
+      nghttp2_data_provider provider = {};
+      provider.read_callback         = on_read_body;
+      //
+      nghttp2_submit_response( p_session, p_frame->hd.stream_id, headers, 2, &provider );
+    }
+    //
+    return 0;
+  }
+
+  //--------------------------------------------------------------------
+  // Write the frames produced by nghttp2
+  void flush( connection * p_conn )
+  {
+    nghttp2_session_send( p_conn->session ); // calls on_send
+    //
+    if ( p_conn->output.empty() )
+      return;
+    //
+    auto * data    = new std::string( std::move( p_conn->output ) );
+    auto * request = new uv_write_t;
+    auto   buffer  = uv_buf_init( data->data(), static_cast< unsigned >( data->size() ) );
+    //
+    p_conn->output.clear();
+    request->data = data;
+    //
+    if ( uv_write( request, reinterpret_cast< uv_stream_t * >( &p_conn->handle ), &buffer, 1, on_write ) != 0 )
+    {
+      delete data;
+      delete request;
+    }
+  }
+
+  //--------------------------------------------------------------------
+  void on_read( uv_stream_t * p_stream, ssize_t p_nread, const uv_buf_t * p_buffer )
+  {
+    auto * conn = static_cast< connection * >( p_stream->data );
+    //
+    if ( p_nread < 0 ||
+         nghttp2_session_mem_recv( conn->session, reinterpret_cast< const uint8_t * >( p_buffer->base ), static_cast< size_t >( p_nread ) ) < 0 )
+    {
+      uv_close( reinterpret_cast< uv_handle_t * >( p_stream ), on_close );
+      return;
+    }
+    //
+    flush( conn );
+  }
+
+  //--------------------------------------------------------------------
+  bool create_session( connection * p_conn )
+  {
+    nghttp2_session_callbacks * callbacks = nullptr;
+    //
+    if ( nghttp2_session_callbacks_new( &callbacks ) != 0 )
+      return false;
+    //
+    nghttp2_session_callbacks_set_send_callback          ( callbacks, on_send       );
+    nghttp2_session_callbacks_set_on_frame_recv_callback ( callbacks, on_frame_recv );
+    //
+    bool ok = nghttp2_session_server_new( &p_conn->session, callbacks, p_conn ) == 0;
+    nghttp2_session_callbacks_del( callbacks );
+    //
+    nghttp2_settings_entry settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, c_max_streams } };
+    //
+    return ok && nghttp2_submit_settings( p_conn->session, NGHTTP2_FLAG_NONE, settings, 1 ) == 0;
+  }
+
+  //--------------------------------------------------------------------
+  void on_connection( uv_stream_t * p_server, int p_status )
+  {
+    if ( p_status < 0 )
+      return;
+    //
+    auto * conn        = new connection;
+    conn->handle.data = conn;
+    //
+    uv_tcp_init( p_server->loop, &conn->handle );
+    //
+    if ( uv_accept( p_server, reinterpret_cast< uv_stream_t * >( &conn->handle ) ) == 0 && create_session( conn ) )
+    {
+      uv_tcp_nodelay( &conn->handle, 1 );
+      uv_read_start( reinterpret_cast< uv_stream_t * >( &conn->handle ), on_alloc, on_read );
+      flush( conn ); // server preface
+    }
+    else
+    {
+      uv_close( reinterpret_cast< uv_handle_t * >( &conn->handle ), on_close );
+    }
+  }
+
+} // namespace
+
+//--------------------------------------------------------------------
+void run_loopback_h2c_server( int p_listen_socket )
+{
+  uv_loop_t * loop   = uv_default_loop();
+  uv_tcp_t    server = {};
+  //
+  if ( uv_tcp_init( loop, &server )                                                       != 0 ||
+       uv_tcp_open( &server, p_listen_socket )                                            != 0 ||
+       uv_listen  ( reinterpret_cast< uv_stream_t * >( &server ), c_backlog, on_connection ) != 0 )
+    std::exit( EXIT_FAILURE );
+  //
+  uv_run( loop, UV_RUN_DEFAULT );
+  //
+  std::exit( EXIT_SUCCESS );
+}
+
+} // namespace bench
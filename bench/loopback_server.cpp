@@ -0,0 +1,178 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "loopback_server.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+  constexpr int         c_backlog         = 4096;
+  constexpr size_t      c_read_buffer_max = 64 * 1024;
+  constexpr const char  c_response[]      = "HTTP/1.1 200 OK\r\n"
+                                            "Content-Type: text/plain\r\n"
+                                            "Content-Length: 2\r\n"
+                                            "\r\n"
+                                            "OK";
+  //
+  struct connection
+  {
+    uv_tcp_t    handle;
+    std::string pending; // received data not yet processed
+  };
+
+  //--------------------------------------------------------------------
+  // Retrieve the Content-Length of the request headers, 0 if absent
+  size_t content_length( std::string_view p_headers )
+  {
+    constexpr std::string_view c_name = "\r\ncontent-length:";
+    //
+    for ( size_t pos = 0; pos + c_name.size() <= p_headers.size(); pos++ )
+      if ( strncasecmp( p_headers.data() + pos, c_name.data(), c_name.size() ) == 0 )
+        return std::strtoul( p_headers.data() + pos + c_name.size(), nullptr, 10 );
+    //
+    return 0;
+  }
+
+  //--------------------------------------------------------------------
+  void on_close( uv_handle_t * p_handle )
+  {
+    delete static_cast< connection * >( p_handle->data );
+  }
+
+  //--------------------------------------------------------------------
+  void on_write( uv_write_t * p_request, int /* p_status */ )
+  {
+    delete p_request;
+  }
+
+  //--------------------------------------------------------------------
+  void on_alloc( uv_handle_t * /* p_handle */, size_t /* p_suggested_size */, uv_buf_t * p_buffer )
+  {
+    static thread_local char buffer[ c_read_buffer_max ]; // data is copied in on_read
+    //
+    *p_buffer = uv_buf_init( buffer, sizeof( buffer ) );
+  }
+
+  //--------------------------------------------------------------------
+  // Answer all the complete requests, possibly pipelined
+  void on_read( uv_stream_t * p_stream, ssize_t p_nread, const uv_buf_t * p_buffer )
+  {
+    auto * conn = static_cast< connection * >( p_stream->data );
+    //
+    if ( p_nread < 0 )
+    {
+      uv_close( reinterpret_cast< uv_handle_t * >( p_stream ), on_close );
+      return;
+    }
+    //
+    conn->pending.append( p_buffer->base, static_cast< size_t >( p_nread ) );
+    //
+    size_t answered = 0;
+    //
+    for ( ;; )
+    {
+      auto view = std::string_view( conn->pending ).substr( answered );
+      auto end  = view.find( "\r\n\r\n" );
+      //
+      if ( end == std::string_view::npos )
+        break;
+      //
+      auto size = end + 4 + content_length( view.substr( 0, end + 2 ) );
+      if ( size > view.size() ) // body not fully received
+        break;
+      //
+      answered += size;
+      //
+      auto * request = new uv_write_t;
+      auto   buffer  = uv_buf_init( const_cast< char * >( c_response ), sizeof( c_response ) - 1 );
+      //
+      if ( uv_write( request, p_stream, &buffer, 1, on_write ) != 0 )
+        delete request;
+    }
+    //
+    conn->pending.erase( 0, answered );
+  }
+
+  //--------------------------------------------------------------------
+  void on_connection( uv_stream_t * p_server, int p_status )
+  {
+    if ( p_status < 0 )
+      return;
+    //
+    auto * conn        = new connection;
+    conn->handle.data = conn;
+    //
+    uv_tcp_init( p_server->loop, &conn->handle );
+    //
+    if ( uv_accept( p_server, reinterpret_cast< uv_stream_t * >( &conn->handle ) ) == 0 )
+    {
+      uv_tcp_nodelay( &conn->handle, 1 );
+      uv_read_start( reinterpret_cast< uv_stream_t * >( &conn->handle ), on_alloc, on_read );
+    }
+    else
+    {
+      uv_close( reinterpret_cast< uv_handle_t * >( &conn->handle ), on_close );
+    }
+  }
+
+} // namespace
+
+//--------------------------------------------------------------------
+int open_listening_socket( uint16_t & p_port )
+{
+  int fd = socket( AF_INET, SOCK_STREAM, 0 );
+  if ( fd < 0 )
+    return -1;
+  //
+  sockaddr_in address = {};
+  socklen_t   length  = sizeof( address );
+  //
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  address.sin_port        = 0; // ephemeral
+  //
+  if ( bind       ( fd, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ) != 0 ||
+       listen     ( fd, c_backlog )                                                     != 0 ||
+       getsockname( fd, reinterpret_cast< sockaddr * >( &address ), &length )           != 0 )
+  {
+    close( fd );
+    return -1;
+  }
+  //
+  p_port = ntohs( address.sin_port );
+  //
+  return fd;
+}
+
+//--------------------------------------------------------------------
+void run_loopback_server( int p_listen_socket )
+{
+  uv_loop_t * loop   = uv_default_loop();
+  uv_tcp_t    server = {};
+  //
+  if ( uv_tcp_init( loop, &server )                                                       != 0 ||
+       uv_tcp_open( &server, p_listen_socket )                                            != 0 ||
+       uv_listen  ( reinterpret_cast< uv_stream_t * >( &server ), c_backlog, on_connection ) != 0 )
+    std::exit( EXIT_FAILURE );
+  //
+  uv_run( loop, UV_RUN_DEFAULT );
+  //
+  std::exit( EXIT_SUCCESS );
+}
+
+} // namespace bench
@@ -0,0 +1,27 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+namespace bench
+{
+
+// Open a TCP socket listening on the loopback interface, on an ephemeral port.
+// Returns the socket, or -1 on error.
+int open_listening_socket( uint16_t & p_port );
+
+// Serve HTTP/1.1 requests received on the listening socket, with keep-alive,
+// answering 200 and a small body to every request. Never returns.
+[[noreturn]] void run_loopback_server( int p_listen_socket );
+
+#ifdef BENCH_HAVE_NGHTTP2
+// Same as run_loopback_server, using HTTP/2 over clear text with prior
+// knowledge (h2c), multiplexing the requests of a connection. Never returns.
+[[noreturn]] void run_loopback_h2c_server( int p_listen_socket );
+#endif
+
+} // namespace bench
@@ -10,16 +10,27 @@
 #include <condition_variable>
 #include <curl/curl.h>
 #include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <pthread.h>
+#include <random>
 #include <set>
 #include <shared_mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <uv.h>
+#include <vector>
 
-#include "authentication.hpp"
-#include "certificates.hpp"
-#include "options.hpp"
+#include "circuit_breaker.hpp"
+#include "host_limiter.hpp"
+#include "metrics.hpp"
+#include "multi_options.hpp"
+#include "profile.hpp"
+#include "retry_policy.hpp"
+#include "utils/mpsc_queue.hpp"
 #include "utils/non_transferable.hpp"
 
 namespace curlev
@@ -28,6 +39,19 @@ namespace curlev
 // The default network timeout
 constexpr auto c_default_network_timeout_ms = 30'000U;
 
+// The maximum number of released easy handles kept for reuse
+constexpr auto c_default_handle_pool_size   = 256U;
+
+// Priority of a request, see Wrapper::priority. The requests waiting in
+// a host limiter or for a callback thread are served by priority first.
+enum class priority_level : unsigned
+{
+  high,   // e.g. interactive requests
+  normal,
+  low     // e.g. bulk transfers
+};
+constexpr auto c_priority_levels = 3U;
+
 class                                WrapperBase;
 template < typename Protocol > class Wrapper;
 
@@ -70,8 +94,11 @@ public:
   ASync();
   ~ASync() override;
   //
-  // Must be called at least once before doing calling any other function of curlev
-  bool start();
+  // Must be called at least once before doing calling any other function of curlev.
+  // p_loops is the number of event loops (each one with its own thread and
+  // libcurl multi handle) between which the requests are distributed.
+  // p_callback_threads is the number of threads invoking the threaded callbacks.
+  bool start( unsigned p_loops = 1, unsigned p_callback_threads = 1 );
   //
   // Must be called at least when the program stops.
   // Waits a maximum of p_timeout_ms milliseconds before forcefully stopping,
@@ -79,39 +106,123 @@ public:
   bool stop( unsigned p_timeout_ms = c_default_network_timeout_ms );
   //
   // Accessors
-  int  peak_requests   () const { return m_multi_running_max;     }
-  int  active_requests () const { return m_multi_running_current; }
-  bool protocol_crashed() const { return m_protocol_has_crashed;  }
+  int      peak_requests   () const { return m_multi_running_max;     }
+  int      active_requests () const { return m_multi_running_current; }
+  bool     protocol_crashed() const { return m_protocol_has_crashed;  }
+  uint64_t pool_hits       () const { return m_pool_hits;             }
+  uint64_t pool_misses     () const { return m_pool_misses;           }
+  //
+  // Statistics of the callback threads
+  struct callback_stats
+  {
+    unsigned threads     = 0; // number of callback threads
+    long     queued      = 0; // callbacks waiting for a thread
+    uint64_t invoked     = 0; // callbacks invoked by the threads
+    uint64_t wait_avg_us = 0; // average and maximal time spent waiting for a thread
+    uint64_t wait_max_us = 0;
+    uint64_t run_avg_us  = 0; // average and maximal duration of the callbacks
+    uint64_t run_max_us  = 0;
+  };
+  //
+  callback_stats callback_statistics() const;
+  //
+  // Counters and histograms of all the event loops. Can be called from any thread,
+  // use to_prometheus() to export them.
+  metrics_snapshot metrics() const;
+  //
+  // Custom executor invoking the threaded callbacks instead of the callback threads,
+  // for example a fiber scheduler or an Asio io_context. It receives tasks that
+  // must be executed once, before stop() returns.
+  using callback_task     = std::function< void() >;
+  using callback_executor = std::function< void( callback_task && ) >;
+  //
+  // Must be called before start(), returns false otherwise.
+  bool set_callback_executor( callback_executor p_executor );
+  //
+  // Limit the reattempts of failed requests (see retry_policy) to a fraction of
+  // the traffic: each new request earns p_ratio reattempt, p_min_per_second are
+  // earned each second, up to p_capacity. Each event loop has its own budget.
+  // Must be called before start(), returns false otherwise. Unlimited by default.
+  bool set_retry_budget( double p_ratio, double p_min_per_second = 10, double p_capacity = 100 );
+  //
+  // Open the circuit of an origin (scheme, host and port) after p_failures consecutive
+  // failures (connection errors, timeouts, 502, 503 and 504): its requests then fail
+  // immediately with c_error_circuit_open, except a probe every p_open_ms milliseconds
+  // whose success closes the circuit.
+  // Must be called before start(), returns false otherwise. Disabled by default.
+  bool set_circuit_breaker( unsigned p_failures, unsigned p_open_ms = c_default_network_timeout_ms );
+  //
+  // State of the origins having failures, the others are closed
+  std::map< std::string, circuit_state > circuits() const;
+  //
+  // Limit the rate and the number of simultaneous requests sent to the origin
+  // (scheme, host and port) of p_url. Requests over the limits wait in their event
+  // loop, without blocking the caller; the requests to a limited origin are all
+  // processed by the same event loop.
+  // Must be called before start(), returns false otherwise.
+  bool set_host_limits( const std::string & p_url, const host_limits & p_limits );
+  //
+  // Open p_connections_per_host connections to each URL in each event loop, before
+  // the traffic arrives, filling the DNS and TLS session caches and the connection
+  // cache of the loops. A HEAD request is sent to each URL, using the default
+  // options and certificates. Connections are opened asynchronously.
+  // Returns the number of requests queued.
+  size_t prewarm( const std::vector< std::string > & p_urls, unsigned p_connections_per_host = 1 );
   //
   // Setting defaults
   bool options       ( const std::string & p_options );
   bool authentication( const std::string & p_credential );
   bool certificates  ( const std::string & p_certificates );
   //
+  // Define a named profile: the current defaults modified by the given CSKV
+  // strings (same syntax as options(), authentication() and certificates()).
+  // It is validated once here, then selected using profile() in the protocols.
+  // Must be called after start(), defining an existing name replaces it.
+  bool define_profile( const std::string & p_name,
+                       const std::string & p_options,
+                       const std::string & p_credential,
+                       const std::string & p_certificates );
+  //
+  // Setting the connection pool options of the event loops. Can be called
+  // before start(), or later: the loops then apply them asynchronously.
+  bool multi_options ( const std::string & p_multi_options );
+  //
 protected:
   template < typename Protocol > friend class Wrapper;
   //
-  // Retrieving defaults
-  void get_default( Options & p_options, Authentication & p_authentication, Certificates & p_certificates ) const;
+  // Retrieving the default profile, and a named profile (nullptr if unknown)
+  profile_ptr get_default() const;
+  profile_ptr get_profile( const std::string & p_name ) const;
   //
-  // Create a new easy handle that *must* be freed using return_handle
-  [[nodiscard]] CURL * get_handle( WrapperBase * p_protocol ) const;
+  // Are the origins of the requests needed (by the circuit breakers or the host limits)
+  bool uses_origin() const noexcept { return m_circuits.enabled() || ! m_host_limits.empty(); }
   //
-  // Release a handle previously allocated by get_handle, ok on nullptr
-  static
+  // Check if a request to the origin can start
+  bool circuit_allows( const std::string & p_origin );
+  //
+  // Create a new easy handle, or reuse a pooled one, that *must* be freed using return_handle
+  [[nodiscard]] CURL * get_handle( WrapperBase * p_protocol );
+  //
+  // Release a handle previously allocated by get_handle, ok on nullptr.
+  // The handle is reset and kept in the pool if possible.
   void return_handle( CURL * & p_curl );
   //
   // Starts the transfer, ok on nullptr
-  // If it fails the wrapper is notified with the curl result code
+  // The request is queued for the uv worker thread, if it fails to start
+  // there the wrapper is notified with c_error_internal_start
   bool start_request( CURL * p_curl, void * p_protocol_cb );
   //
+  // Starts several transfers, each loop is woken up only once.
+  // Returns the number of queued requests: the first ones of p_requests.
+  size_t start_requests( const std::vector< std::pair< CURL *, void * > > & p_requests );
+  //
   // Aborts a request previously started
-  void abort_request( CURL * p_curl );
+  void abort_request( WrapperBase * p_protocol, CURL * p_curl );
   //
-private:
+  // Resumes a request paused by its body receiver
+  void resume_request( WrapperBase * p_protocol, CURL * p_curl );
   //
-  // Number of start_request/abort_request waiting for m_uv_run_mutex
-  std::atomic_long m_nb_waiting_requests = 0;
+private:
   //
   // Number of currently running (including waiting) requests, from start_request to post Wrapper notification
   std::atomic_long m_nb_running_requests = 0;
@@ -119,11 +230,12 @@ private:
   // If crashes occurred while invoking protocol's callback
   std::atomic_bool m_protocol_has_crashed = false;
   //
-  // Used by protocol classes as default values
-  mutable std::shared_mutex m_default_locks;
-  Options                   m_default_options;
-  Authentication            m_default_authentication;
-  Certificates              m_default_certificates;
+  // Used by protocol classes as default values. The default profile is
+  // replaced, never modified, when the defaults are changed.
+  mutable std::shared_mutex             m_default_locks;
+  profile_ptr                           m_default_profile = std::make_shared< const Profile >();
+  std::map< std::string, profile_ptr >  m_profiles;
+  MultiOptions                          m_default_multi_options; // not reset by start()
   //
   // libcurl global
   //
@@ -135,6 +247,17 @@ private:
   bool global_init ();
   void global_clear();
   //
+  // Pool of reset easy handles
+  //
+  std::mutex            m_pool_mutex;
+  std::vector< CURL * > m_pool;
+  size_t                m_pool_size_max = 0; // 0 when ASync is not started
+  std::atomic_uint64_t  m_pool_hits     = 0; // get_handle reused a pooled handle
+  std::atomic_uint64_t  m_pool_misses   = 0; // get_handle created a new handle
+  //
+  void pool_init ();
+  void pool_clear();
+  //
   // libcurl share interface - share data between multiple easy handles (DNS, TLS...)
   //
   std::array< shared_mutex, CURL_LOCK_DATA_LAST > m_share_locks;
@@ -149,19 +272,99 @@ private:
       curl_lock_access p_access,
       void *           p_user_ptr );
   //
-  // libcurl multi interface - enable multiple simultaneous transfers in the same thread
+  // Commands sent by users' threads to the uv worker threads
+  //
+  enum class command
+  {
+    start,     // add the easy handle to multi
+    abort,     // abort the request of the easy handle
+    abort_all, // abort all pending requests
+    resume,    // resume the paused request of the easy handle
+    prewarm,   // add the easy handle, not attached to a wrapper, to multi
+    configure  // apply the default multi options
+  };
+  //
+  using uv_command = std::tuple< command, CURL * >;
   //
-  CURLM *            m_multi_handle          = nullptr;
-  std::atomic_int    m_multi_running_max     = 0; // maximum simultaneous requests reached
-  std::atomic_int    m_multi_running_current = 0; // current simultaneous request
-  std::set< CURL * > m_multi_requests_started;    // easy handles currently owned by multi/retry
-  std::set< CURL * > m_multi_requests_retrying;   // easy handles waiting on their retry timer
+  // A shard is an event loop, its worker thread and its libcurl multi handle.
+  // All the members, except load and uv_commands, are only accessed by the shard's worker thread.
   //
-  bool       multi_init ();
-  void       multi_clear();
-  void       multi_update_running_stats( int p_running_handles );
-  void       multi_fetch_messages();
-  static int multi_cb_timer( CURLM * p_multi, long p_timeout_ms, void * p_clientp );
+  struct shard : private non_transferable
+  {
+    ASync &                  async;
+    unsigned                 index;
+    std::atomic_long         load            = 0;       // requests assigned to this shard, from start_request to post Wrapper notification
+    int                      running_handles = 0;       // last number of running handles reported by multi
+    //
+    // libcurl multi interface - enable multiple simultaneous transfers in the same thread
+    CURLM *                  multi_handle    = nullptr; // SOCKETDATA and TIMERDATA are the shard
+    std::set< CURL * >       requests_started;          // easy handles currently owned by multi/retry
+    std::set< CURL * >       requests_retrying;         // easy handles waiting on their retry timer
+    std::set< CURL * >       requests_prewarming;       // easy handles opening a connection for prewarm()
+    std::set< CURL * >       requests_throttled;        // easy handles waiting in a host limiter
+    //
+    // libuv - asynchronous I/O
+    std::thread              uv_worker;
+    uv_loop_t *              uv_loop         = nullptr; // data is the shard
+    uv_timer_t               uv_timer        = {};      // data is the shard
+    uv_async_t               uv_async        = {};      // data is the shard, wakes up the worker thread
+    uv_prepare_t             uv_prepare      = {};      // data is the shard, measures the loop iterations
+    uv_timer_t               uv_limiter      = {};      // data is the shard, releases the throttled requests
+    uint64_t                 limiter_due_ms  = 0;       // when uv_limiter expires, 0 if stopped
+    uv_timer_t               uv_hedge        = {};      // data is the shard, starts the duplicates of hedged requests
+    uint64_t                 last_prepare_ns = 0;       // time and loop idle time of the last uv_prepare_cb
+    uint64_t                 last_idle_ns    = 0;
+    mpsc_queue< uv_command > uv_commands;
+    //
+    loop_metrics             metrics;
+    //
+    // Limits of the hosts, see set_host_limits
+    std::unordered_map< std::string, host_limiter > limiters;
+    //
+    // Hedged requests by time of their next duplicate, and the latency used by HTTP::hedge( percentile )
+    std::set< std::pair< uint64_t, CURL * > > hedges_due;
+    histogram_snapshot       hedge_latency;
+    uint64_t                 hedge_latency_ms = 0;      // when hedge_latency was copied
+    //
+    // Reattempts of failed requests
+    retry_budget             retry_tokens;
+    std::minstd_rand         retry_random;              // jitter of the retry delays
+    //
+    shard( ASync & p_async, unsigned p_index ) :
+      async( p_async ), index( p_index ), retry_random( static_cast< std::minstd_rand::result_type >( uv_hrtime() + p_index ) ) {}
+  };
+  //
+  std::vector< std::unique_ptr< shard > > m_shards;
+  std::atomic_uint                        m_shards_next = 0; // first shard examined by select_shard
+  //
+  // Configuration of the retry budget of the shards, see set_retry_budget
+  double m_retry_budget_ratio      = 0;
+  double m_retry_budget_per_second = 0;
+  double m_retry_budget_capacity   = 0; // 0: unlimited
+  //
+  // Circuit breakers of the origins, see set_circuit_breaker
+  circuit_breakers     m_circuits;
+  std::atomic_uint64_t m_circuit_rejected = 0; // requests not started
+  //
+  // Limits of the origins, see set_host_limits
+  std::map< std::string, host_limits > m_host_limits;
+  //
+  shard & select_shard ( const std::string & p_origin );
+  shard * queue_request( CURL * p_curl, void * p_protocol_cb );
+  //
+  // libcurl multi interface
+  //
+  std::atomic_int m_multi_running_max     = 0; // maximum simultaneous requests reached, all shards included
+  std::atomic_int m_multi_running_current = 0; // current simultaneous request, all shards included
+  //
+  static bool multi_init ( shard & p_shard );
+  static void multi_clear( shard & p_shard );
+  static bool multi_configure( shard & p_shard );
+  static bool multi_attach   ( shard & p_shard, CURL * p_curl );
+  void        multi_update_running_stats( shard & p_shard, int p_running_handles );
+  void        multi_fetch_messages      ( shard & p_shard );
+  void        multi_clear_prewarming    ( shard & p_shard );
+  static int  multi_cb_timer( CURLM * p_multi, long p_timeout_ms, void * p_clientp );
   static int multi_cb_socket(
       CURL *        p_easy,
       curl_socket_t p_socket,
@@ -171,50 +374,78 @@ private:
   //
   // libuv - asynchronous I/O
   //
-  mutable std::mutex              m_uv_run_mutex;
-  mutable std::condition_variable m_uv_run_cv;
-  bool                            m_uv_running = false;   // worker thread is running
-  std::thread                     m_uv_worker;
-  uv_loop_t *                     m_uv_loop    = nullptr; // data is the ASync object
-  uv_timer_t                      m_uv_timer   = {};      // data is the ASync object
-  //
-  bool        uv_init ();
-  void        uv_clear();
-  void        uv_run_accept_requests( std::unique_lock< std::mutex > & p_lock ) const;
-  void        uv_run_wait_requests  ( std::unique_lock< std::mutex > & p_lock ) const;
+  std::atomic_bool m_uv_running = false; // worker threads are running
+  //
+  bool        uv_init ( shard & p_shard );
+  void        uv_clear( shard & p_shard );
   static void uv_io_cb     ( uv_poll_t * p_handle, int p_status, int p_events );
   static void uv_timeout_cb( uv_timer_t * p_handle );
   static void uv_restart_cb( uv_timer_t * p_handle );
+  static void uv_async_cb  ( uv_async_t * p_handle );
+  static void uv_prepare_cb( uv_prepare_t * p_handle );
+  //
+  static bool send_command( shard & p_shard, command p_command, CURL * p_curl );
+  void        run_commands( shard & p_shard );
+  void        multi_start ( shard & p_shard, CURL * p_curl );
+  static bool apply_deadline( CURL * p_curl, WrapperBase & p_wrapper );
+  //
+  // Host limits
+  //
+  static host_limiter * find_limiter( shard & p_shard, const WrapperBase & p_wrapper );
+  bool        throttle_request( shard & p_shard, CURL * p_curl );
+  static void leave_limiter   ( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper );
+  static void limiter_wake    ( shard & p_shard, uint64_t p_delay_ms );
+  static uint64_t deadline_delay_ms( const host_limiter & p_limiter );
+  static void uv_limiter_cb   ( uv_timer_t * p_handle );
   //
   // Context shared between multi and uv
   //
   struct curl_context : private non_transferable
   {
-    ASync &       async;
+    shard &       owner;
     curl_socket_t curl;
     uv_poll_t     poll = {};
     //
-    curl_context( ASync & p_async, curl_socket_t p_curl ) :
-      async( p_async ), curl( p_curl ){}
+    curl_context( shard & p_owner, curl_socket_t p_curl ) :
+      owner( p_owner ), curl( p_curl ){}
   };
   //
-  curl_context * create_curl_context ( curl_socket_t p_socket );
+  static
+  curl_context * create_curl_context ( shard & p_shard, curl_socket_t p_socket );
   static
   void           destroy_curl_context( curl_context * p_context ); // cppcheck-suppress functionStatic
   //
   // Callback thread
   //
   using wrapper_shared_ptr_ptr = std::shared_ptr< WrapperBase > *;            // the Protocol object to call
-  using cb_job                 = std::tuple< wrapper_shared_ptr_ptr, long >;  // the Protocol and the result
-  //
-  mutable std::mutex              m_cb_mutex;
-  mutable std::condition_variable m_cb_cv;
-  std::deque< cb_job >            m_cb_queue;
-  bool                            m_cb_running = false; // worker thread is running
-  std::thread                     m_cb_worker;
-  //
-  bool cb_init ();
+  using cb_job                 = std::tuple< wrapper_shared_ptr_ptr, long, uint64_t >; // the Protocol, the result and the queuing time
+  //
+  // The callback threads share a queue by priority, the higher priority
+  // queue being served first. A Wrapper has at most one job queued at a
+  // time, so the order of its notifications is kept.
+  std::array< std::deque< cb_job >, c_priority_levels > m_cb_queues;          // protected by m_cb_mutex
+  std::vector< std::thread >                            m_cb_threads;
+  std::atomic_long                                      m_cb_pending = 0;     // jobs in all queues
+  std::atomic_bool                                      m_cb_running = false; // worker threads are running
+  mutable std::mutex                                    m_cb_mutex;           // used with m_cb_cv to wait for jobs
+  mutable std::condition_variable                       m_cb_cv;
+  //
+  // Replaces the callback threads if set
+  callback_executor m_cb_executor;
+  //
+  // Statistics, in nanoseconds
+  std::atomic_uint64_t m_cb_invoked     = 0;
+  std::atomic_uint64_t m_cb_wait_ns     = 0;
+  std::atomic_uint64_t m_cb_wait_ns_max = 0;
+  std::atomic_uint64_t m_cb_run_ns      = 0;
+  std::atomic_uint64_t m_cb_run_ns_max  = 0;
+  //
+  bool cb_init ( unsigned p_threads );
   void cb_clear();
+  void cb_push ( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
+  bool cb_pop  ( cb_job & p_job );
+  void cb_run  ();
+  void cb_invoke( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code, uint64_t p_queued_ns );
   //
   // To read data to send during a transfer
   static size_t curl_cb_read( void * p_ptr, size_t p_size, size_t p_nmemb, void * p_userdata );
@@ -228,14 +459,31 @@ private:
   // To store header received during the transfer
   static size_t curl_cb_header( const char * p_buffer, size_t p_size, size_t p_nitems, void * p_userdata );
   //
+  // To count the connections opened by a shard
+  static curl_socket_t curl_cb_open_socket ( void * p_clientp, curlsocktype p_purpose, curl_sockaddr * p_address );
+  static int           curl_cb_close_socket( void * p_clientp, curl_socket_t p_socket );
+  //
   // Wait for all pending requests to finish
   bool wait_pending_requests( unsigned p_timeout_ms ) const;
   //
   // Handles the termination of the request
-  void request_completed( CURL * p_curl, long p_result_code );
+  void request_completed( shard & p_shard, CURL * p_curl, long p_result_code );
+  void retry_or_post    ( shard & p_shard, CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
+  static bool retry_delay( shard & p_shard, WrapperBase & p_wrapper, long p_result_code, uint64_t & p_delay_ms );
+  //
+  // Hedged requests, see HTTP::hedge
+  class hedge_receiver;
+  //
+  static void hedge_schedule  ( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper );
+  static void hedge_unschedule( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper );
+  static void hedge_rearm     ( shard & p_shard );
+  void        hedge_start     ( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper );
+  bool        hedge_completed ( shard & p_shard, CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
+  void        hedge_abandon   ( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper );
+  static void uv_hedge_cb     ( uv_timer_t * p_handle );
   //
   // Returns the operation outcome to the wrapper, immediately or delayed
-  void post_to_wrapper( CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
+  void post_to_wrapper( shard & p_shard, CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
   //
   // Call the wrapper, delete the shared_ptr
   void invoke_wrapper( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code );
@@ -243,8 +491,10 @@ private:
   // Retrieve the Wrapper from the curl handle
   static wrapper_shared_ptr_ptr get_wrapper_from_curl( CURL * p_curl );
   //
-  static void abort_retrying_request( wrapper_shared_ptr_ptr & p_wrapper );
-         void abort_started_request ( wrapper_shared_ptr_ptr & p_wrapper, CURL * p_curl );
+  static void abort_retrying_request( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code = CURLE_ABORTED_BY_CALLBACK );
+         void abort_started_request ( shard & p_shard, wrapper_shared_ptr_ptr & p_wrapper, CURL * p_curl );
+         void abort_one_request     ( shard & p_shard, CURL * p_curl );
+         void abort_all_requests    ( shard & p_shard );
          void abort_pending_requests();
 };
 
@@ -7,6 +7,7 @@
 
 #include <curl/curl.h>
 #include <string>
+#include <utility>
 
 namespace curlev
 {
@@ -27,6 +28,13 @@ public:
   //   secret     password or token
   bool set( const std::string & p_cskv );
   //
+  // Typed setters, equivalent to the keys above without parsing a string
+  enum class Mode { none, basic, digest, bearer };
+  //
+  Authentication & mode  ( Mode p_mode          ) noexcept { m_mode   = p_mode;                return *this; }
+  Authentication & user  ( std::string p_user   )          { m_user   = std::move( p_user   ); return *this; }
+  Authentication & secret( std::string p_secret )          { m_secret = std::move( p_secret ); return *this; }
+  //
   // Apply credential to curl easy handle
   bool apply( CURL * p_curl ) const;
   //
@@ -34,8 +42,6 @@ public:
   void set_default();
   //
 private:
-  enum class Mode { none, basic, digest, bearer };
-  //
   Mode        m_mode = Mode::none;
   std::string m_user;
   std::string m_secret;
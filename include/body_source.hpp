@@ -0,0 +1,47 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "utils/non_transferable.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// A source of request body, read as the transfer progresses, allowing
+// to upload a file, a pipe or generated data without holding it in memory.
+// Its methods are called by the ASync uv thread.
+class body_source : private non_transferable
+{
+public:
+  // Total size of the body, or c_unknown_size: the body is then sent
+  // using chunked transfer encoding
+  static constexpr int64_t c_unknown_size = -1;
+  //
+  virtual int64_t size() const = 0;
+  //
+  // Copy at most p_size bytes into p_buffer, set p_read to the number
+  // of copied bytes: 0 means the end of the body.
+  // Returns false on error, the transfer is then aborted.
+  virtual bool read( char * p_buffer, size_t p_size, size_t & p_read ) = 0;
+  //
+  // Restart reading from the beginning, needed when libcurl must send the body
+  // again (after some redirections or authentication).
+  // Returns false if not possible.
+  virtual bool rewind() { return false; }
+  //
+  // Restart reading from p_offset. By default only the beginning is supported.
+  // Returns false if not possible.
+  virtual bool seek( int64_t p_offset ) { return p_offset == 0 && rewind(); }
+  //
+protected:
+  body_source() = default;
+};
+
+} // namespace curlev
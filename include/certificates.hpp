@@ -8,6 +8,7 @@
 #include <curl/curl.h>
 #include <map>
 #include <string>
+#include <utility>
 
 namespace curlev
 {
@@ -23,6 +24,23 @@ public:
   // See the reference manual for a complete description.
   bool set( const std::string & p_cskv );
   //
+  // Typed setters, equivalent to the keys above without parsing a string
+  Certificates & engine           ( std::string p_value ) { m_engine            = std::move( p_value ); return *this; }
+  Certificates & sslcert          ( std::string p_value ) { m_sslcert           = std::move( p_value ); return *this; }
+  Certificates & sslcerttype      ( std::string p_value ) { m_sslcerttype       = std::move( p_value ); return *this; }
+  Certificates & sslkey           ( std::string p_value ) { m_sslkey            = std::move( p_value ); return *this; }
+  Certificates & sslkeytype       ( std::string p_value ) { m_sslkeytype        = std::move( p_value ); return *this; }
+  Certificates & keypasswd        ( std::string p_value ) { m_keypasswd         = std::move( p_value ); return *this; }
+  Certificates & cainfo           ( std::string p_value ) { m_cainfo            = std::move( p_value ); return *this; }
+  Certificates & capath           ( std::string p_value ) { m_capath            = std::move( p_value ); return *this; }
+  Certificates & proxy_sslcert    ( std::string p_value ) { m_proxy_sslcert     = std::move( p_value ); return *this; }
+  Certificates & proxy_sslcerttype( std::string p_value ) { m_proxy_sslcerttype = std::move( p_value ); return *this; }
+  Certificates & proxy_sslkey     ( std::string p_value ) { m_proxy_sslkey      = std::move( p_value ); return *this; }
+  Certificates & proxy_sslkeytype ( std::string p_value ) { m_proxy_sslkeytype  = std::move( p_value ); return *this; }
+  Certificates & proxy_keypasswd  ( std::string p_value ) { m_proxy_keypasswd   = std::move( p_value ); return *this; }
+  Certificates & proxy_cainfo     ( std::string p_value ) { m_proxy_cainfo      = std::move( p_value ); return *this; }
+  Certificates & proxy_capath     ( std::string p_value ) { m_proxy_capath      = std::move( p_value ); return *this; }
+  //
   // Apply credential to curl easy handle
   bool apply( CURL * p_curl ) const;
   //
@@ -0,0 +1,69 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// State of the circuit breaker of an origin
+enum class circuit_state
+{
+  closed,   // requests are started
+  open,     // requests fail immediately
+  half_open // a probe request is allowed, its result closes or reopens the circuit
+};
+
+//--------------------------------------------------------------------
+// The circuit breakers of all the origins (scheme, host and port) of an
+// ASync. After p_failures consecutive failures, the circuit of the origin
+// opens for p_open_ms milliseconds; then a single probe request is allowed
+// every p_open_ms, until one succeeds. Only the origins having failures
+// are tracked. Thread safe.
+class circuit_breakers
+{
+public:
+  // Must be called before being used, not thread safe
+  void configure( unsigned p_failures, unsigned p_open_ms ) noexcept;
+  //
+  // Nothing is tracked until configured
+  bool enabled() const noexcept { return m_failures_max > 0; }
+  //
+  // Return false if a request to the origin must not be started
+  bool allow( const std::string & p_origin, uint64_t p_now_ms );
+  //
+  // Track the result of a request to the origin
+  void record( const std::string & p_origin, long p_result_code, uint64_t p_now_ms );
+  //
+  // State of the tracked origins
+  std::map< std::string, circuit_state > states( uint64_t p_now_ms ) const;
+  //
+  // Is the result code a sign that the origin is unavailable: a transport
+  // error, or 502, 503 and 504 (other codes mean that it is working)
+  static bool is_failure( long p_result_code );
+  //
+private:
+  struct breaker
+  {
+    unsigned failures = 0;     // consecutive
+    bool     open     = false;
+    uint64_t probe_ms = 0;     // when open, time of the next probe allowed
+  };
+  //
+  unsigned m_failures_max = 0;
+  unsigned m_open_ms      = 0;
+  //
+  mutable std::mutex                         m_mutex; // protects m_breakers
+  std::unordered_map< std::string, breaker > m_breakers;
+};
+
+} // namespace curlev
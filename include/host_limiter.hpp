@@ -0,0 +1,63 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <curl/curl.h>
+#include <cstdint>
+#include <deque>
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// Limits of the requests sent to an origin, see ASync::set_host_limits
+struct host_limits
+{
+  double   requests_per_second = 0; // 0: unlimited
+  double   burst               = 0; // requests sent at once after an idle period, 0: one second of traffic
+  unsigned max_in_flight       = 0; // 0: unlimited
+};
+
+//--------------------------------------------------------------------
+// The token bucket and the in-flight counter enforcing host_limits, and
+// the requests waiting for them. It is only used by an event loop thread.
+class host_limiter
+{
+public:
+  explicit host_limiter( const host_limits & p_limits );
+  //
+  // Take a token and an in-flight slot if both are available
+  bool try_acquire( uint64_t p_now_ms ) noexcept;
+  //
+  // Free the in-flight slot taken by try_acquire
+  void release() noexcept;
+  //
+  // Delay before a token is available, 0 if one is. UINT64_MAX if waiting
+  // for an in-flight slot: only a release can unblock the requests.
+  uint64_t wait_ms( uint64_t p_now_ms ) noexcept;
+  //
+  // Requests over the limits, by rank (lower first) then in arrival order
+  struct waiter
+  {
+    CURL *   curl        = nullptr;
+    unsigned rank        = 0;
+    uint64_t deadline_ns = 0; // when the request is abandoned, 0 if never
+  };
+  std::deque< waiter > waiting;
+  //
+  // Insert a request in waiting
+  void wait( CURL * p_curl, unsigned p_rank, uint64_t p_deadline_ns = 0 );
+  //
+private:
+  void refill( uint64_t p_now_ms ) noexcept;
+  //
+  host_limits m_limits;
+  double      m_tokens    = 0;
+  uint64_t    m_last_ms   = 0;
+  unsigned    m_in_flight = 0;
+};
+
+} // namespace curlev
@@ -5,10 +5,14 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstddef>
 #include <curl/curl.h>
+#include <functional>
 #include <future>
+#include <memory>
 #include <string>
+#include <string_view>
 
 #if __has_include( <nlohmann/json.hpp> )
   #include <nlohmann/json.hpp>
@@ -19,6 +23,7 @@
 
 #include "utils/map_utils.hpp"
 #include "async.hpp"
+#include "body_source.hpp"
 #include "mime.hpp"
 #include "wrapper.hpp"
 
@@ -64,9 +69,41 @@ public:
   // Adding body to a request. Only one of them must be used.
   //
   HTTP & set_body      ( const std::string & p_content_type, std::string && p_body );
+  HTTP & set_body      ( const std::string & p_content_type, std::unique_ptr< body_source > && p_source );
+  HTTP & set_body_file ( const std::string & p_content_type, const std::string & p_path );
   HTTP & set_parameters( const key_values &  p_body_parameters );
   HTTP & set_mime      ( const mime::parts & p_parts );
   //
+  // Receive the response body as it arrives, instead of storing it (get_body() is then empty).
+  // The receiver is called by the ASync uv thread and must be fast. It returns false to pause
+  // the transfer: the same data is passed again once resume() is called.
+  // The maximal response size applies to the total received size. Once data was
+  // received, the request is not reattempted.
+  HTTP & on_data( std::function< bool( std::string_view ) > && p_receiver );
+  //
+  // Hedge an idempotent request: if no response is received after p_after, a duplicate
+  // is sent on another easy handle, up to p_max_extra times. The first response which
+  // is not a server error (5xx) is used, the other transfers are aborted, and the
+  // callback is invoked once. Only GET and HEAD requests without body are hedged, and
+  // not with on_data() and write_to_file() / write_to_fd().
+  HTTP & hedge( std::chrono::milliseconds p_after, unsigned p_max_extra = 1 );
+  //
+  // Same, the delay being a percentile (above 0, up to 100) of the latency of the requests
+  // of the event loop. The request is not hedged until some requests have completed.
+  // Another percentile sets the error c_error_options_set.
+  HTTP & hedge_percentile( double p_percentile, unsigned p_max_extra = 1 );
+  //
+  // Write the response body to a file (created or truncated, closed once the transfer
+  // is finished) or to a file descriptor (left open), instead of storing it. The file
+  // is preallocated if the size is known. The writes are done by the ASync uv thread.
+  // The maximal response size applies to the total received size.
+  // The descriptor should be a regular file: the writes are blocking, so a slow pipe
+  // or socket delays all the transfers of the event loop, and a non-blocking one fails
+  // the transfer when full. A request that wrote to a non-seekable descriptor is not
+  // reattempted.
+  HTTP & write_to_file( const std::string & p_path );
+  HTTP & write_to_fd  ( int p_fd );
+  //
   // These accessors return references for efficiency, directly exposing the object's
   // internal. They must only be used after the request has fully completed to ensure data
   // consistency and avoid unstable values during ongoing operations.
@@ -87,11 +124,12 @@ public:
   // be used.
   struct response
   {
-    long          code = 0;
-    key_values_ci headers;
-    std::string   redirect_url;
-    std::string   content_type;
-    std::string   body;
+    long            code = 0;
+    key_values_ci   headers;
+    std::string     redirect_url;
+    std::string     content_type;
+    std::string     body;
+    curlev::timings timings;
     //
     #if __has_include( <nlohmann/json.hpp> )
       bool get_json( nlohmann::json & p_json ) const noexcept;
@@ -104,9 +142,14 @@ public:
   std::future< response > launch();
   //
 protected:
+  friend class Wrapper< HTTP >;
+  //
   // Prevent creating directly an instance of the class, the Wrapper::create() method must be used
   explicit HTTP( ASync & p_async ) : Wrapper< HTTP >( p_async, "http,https" ) {};
   //
+  // Move the received data into a response, once the transfer is finished
+  response take_response();
+  //
   // Called by Wrapper before starting a request
   bool prepare_protocol() override;
   //
@@ -126,6 +169,9 @@ private:
   curl_slist * m_curl_headers = nullptr;  // must be persistent (CURLOPT_HTTPHEADER)
   curl_mime *  m_curl_mime    = nullptr;  // must be persistent (CURLOPT_MIMEPOST)
   //
+  // GET or HEAD request, the only ones hedged
+  bool m_idempotent = false;
+  //
   // Release extra curl handles that were used during the operation
   void release_curl_extras();
 };
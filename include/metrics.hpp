@@ -0,0 +1,131 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// A counter having a single writer thread: incrementing it does not need
+// an atomic read-modify-write, it can be read from any thread.
+class single_writer_counter
+{
+public:
+  void     add ( uint64_t p_value = 1 ) noexcept { m_value.store( m_value.load( std::memory_order_relaxed ) + p_value, std::memory_order_relaxed ); }
+  uint64_t load() const noexcept                 { return m_value.load( std::memory_order_relaxed ); }
+  //
+private:
+  std::atomic_uint64_t m_value = 0;
+};
+
+//--------------------------------------------------------------------
+// The content of a histogram at a given time
+struct histogram_snapshot
+{
+  // Values below c_linear_max have their own bucket, then each power of 2
+  // is split in c_sub_buckets buckets (a relative precision of 12.5%),
+  // up to 2^c_exponent_max (about 12 days in microseconds).
+  static constexpr unsigned c_linear_max   = 16;
+  static constexpr unsigned c_sub_bits     = 3;
+  static constexpr unsigned c_sub_buckets  = 1U << c_sub_bits;
+  static constexpr unsigned c_exponent_min = 4; // log2( c_linear_max )
+  static constexpr unsigned c_exponent_max = 40;
+  static constexpr size_t   c_buckets      = c_linear_max + ( c_exponent_max - c_exponent_min ) * c_sub_buckets;
+  //
+  std::array< uint64_t, c_buckets > counts = {};
+  uint64_t                          count  = 0; // number of recorded values
+  uint64_t                          sum    = 0; // sum of the recorded values
+  //
+  // Index of the bucket receiving p_value, and the exclusive upper bound of a bucket
+  static size_t   bucket_of   ( uint64_t p_value );
+  static uint64_t bucket_upper( size_t p_bucket );
+  //
+  // Upper bound of the bucket containing the given percentile (0 to 100), 0 if empty
+  uint64_t percentile( double p_percentile ) const;
+  //
+  // Add the content of another snapshot
+  histogram_snapshot & operator+=( const histogram_snapshot & p_other );
+};
+
+//--------------------------------------------------------------------
+// An HDR-style histogram with a single writer thread
+class histogram
+{
+public:
+  void record( uint64_t p_value ) noexcept;
+  //
+  // Add the current content to p_snapshot
+  void add_to( histogram_snapshot & p_snapshot ) const;
+  //
+private:
+  std::array< single_writer_counter, histogram_snapshot::c_buckets > m_counts;
+  single_writer_counter                                              m_sum;
+};
+
+//--------------------------------------------------------------------
+// Metrics of an event loop, only updated by its worker thread
+struct loop_metrics
+{
+  // Result codes counted individually: internal errors, libcurl errors and protocol codes
+  static constexpr long c_result_min = -64;
+  static constexpr long c_result_max = 999;
+  //
+  single_writer_counter requests_started;      // added to multi
+  single_writer_counter requests_completed;    // returned to the wrapper
+  single_writer_counter requests_retried;      // reattempts scheduled
+  single_writer_counter requests_retry_denied; // reattempts refused by the retry budget
+  single_writer_counter requests_throttled;    // delayed by a host limiter
+  single_writer_counter requests_hedged;       // duplicates started by hedged requests
+  single_writer_counter hedges_won;            // hedged requests answered by a duplicate
+  single_writer_counter loop_iterations;
+  single_writer_counter connections_opened;    // sockets opened by libcurl
+  single_writer_counter connections_closed;
+  std::array< single_writer_counter, c_result_max - c_result_min + 1 > results;
+  histogram             request_latency_us;    // from start_request to completion
+  histogram             loop_busy_us;          // time spent processing events by loop iteration
+  //
+  void record_result( long p_result_code ) noexcept;
+};
+
+//--------------------------------------------------------------------
+// A consistent enough copy of the metrics of all the event loops, see ASync::metrics()
+struct metrics_snapshot
+{
+  uint64_t                    requests_started      = 0;
+  uint64_t                    requests_completed    = 0;
+  uint64_t                    requests_retried      = 0;
+  uint64_t                    requests_retry_denied = 0; // by the retry budget
+  uint64_t                    requests_throttled    = 0; // delayed by a host limiter
+  uint64_t                    requests_hedged       = 0; // duplicates started by hedged requests
+  uint64_t                    hedges_won            = 0; // hedged requests answered by a duplicate
+  long                        requests_active       = 0; // from start_request to the notification of the wrapper
+  int                         requests_peak         = 0; // maximum simultaneous transfers
+  std::map< long, uint64_t >  results;                   // number of completed requests by result code
+  long                        callbacks_queued      = 0; // waiting for a callback thread or the executor
+  uint64_t                    callbacks_invoked     = 0;
+  uint64_t                    loop_iterations       = 0;
+  uint64_t                    connections_opened    = 0;
+  uint64_t                    connections_closed    = 0;
+  long                        connections_limit     = 0; // max_total_connections of all loops, 0 if unlimited
+  bool                        protocol_crashed      = false;
+  long                        circuits_open         = 0; // open or half-open circuit breakers
+  uint64_t                    circuit_rejected      = 0; // requests failed with c_error_circuit_open
+  histogram_snapshot          request_latency_us;
+  histogram_snapshot          loop_busy_us;
+};
+
+// Serialize the metrics in the Prometheus text exposition format,
+// each metric name starting with p_prefix
+std::string to_prometheus( const metrics_snapshot & p_metrics, const std::string & p_prefix = "curlev" );
+
+} // namespace curlev
@@ -0,0 +1,52 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <curl/curl.h>
+#include <string>
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// This class is used to set the connection pool options of the libcurl
+// multi handles from a string, and apply them to each event loop of ASync.
+// The limits apply to each event loop.
+class MultiOptions
+{
+public:
+  // Expect a CSKV list of options to set. Example:
+  //   max_host_connections=8,maxconnects=64
+  // See the reference manual for a complete description.
+  // Available keys are:
+  //   Name                   Default  Unit    Comment
+  //   max_concurrent_streams 100      count   maximum HTTP/2 streams multiplexed over a connection
+  //   max_host_connections   0        count   maximum connections to a single host, 0 for no limit
+  //   max_total_connections  0        count   maximum simultaneous connections, 0 for no limit
+  //   maxconnects            0        count   size of the connection cache, 0 for libcurl default
+  //   multiplex              1        0 or 1  multiplex HTTP/2 transfers over a connection
+  bool set( const std::string & p_cskv );
+  //
+  // Apply options to curl multi handle
+  bool apply( CURLM * p_multi ) const;
+  //
+  // Reset options to their default values
+  void set_default();
+  //
+  // Accessors
+  long max_total_connections() const { return m_max_total_connections; }
+  //
+private:
+  static constexpr long c_default_concurrent_streams = 100; // libcurl default
+  //
+  long m_max_concurrent_streams = c_default_concurrent_streams;
+  long m_max_host_connections   = 0;
+  long m_max_total_connections  = 0;
+  long m_maxconnects            = 0;
+  bool m_multiplex              = true;
+};
+
+} // namespace curlev
@@ -5,8 +5,10 @@
 
 #pragma once
 
+#include <chrono>
 #include <curl/curl.h>
 #include <string>
+#include <utility>
 
 namespace curlev
 {
@@ -28,14 +30,35 @@ public:
   //   connect_timeout    30000    milliseconds  connection timeout
   //   cookies            0        0 or 1        receive and resend cookies
   //   follow_location    0        0,1,2,3       follow HTTP 3xx redirects
+  //   http_version                string        1.0, 1.1, 2, 2tls, 2prior or 3
   //   insecure           0        0 or 1        disables certificate validation
   //   maxredirs          5        count         maximum number of redirects allowed
+  //   pipewait           0        0 or 1        wait for a connection to multiplex on
   //   proxy                       string        the SOCKS or HTTP URl to a proxy
   //   rcpt_allow_fails   0        0 or 1        continue if some recipients fail
   //   timeout            30000    milliseconds  receive data timeout
   //   verbose            0        0 or 1        debug log on console
   bool set( const std::string & p_cskv );
   //
+  // Typed setters, equivalent to the keys above without parsing a string.
+  // Example:
+  //   options.timeout( 500ms ).follow_location( 1 );
+  Options & accept_compression( bool p_value                      ) noexcept { m_accept_compression = p_value;                                return *this; }
+  Options & connect_timeout   ( std::chrono::milliseconds p_value ) noexcept { m_connect_timeout    = static_cast< long >( p_value.count() ); return *this; }
+  Options & cookies           ( bool p_value                      ) noexcept { m_cookies            = p_value;                                return *this; }
+  Options & follow_location   ( long p_value                      ) noexcept { m_follow_location    = p_value;                                return *this; }
+  Options & http_version      ( long p_value                      ) noexcept { m_http_version       = p_value;                                return *this; } // CURL_HTTP_VERSION_*
+  Options & insecure          ( bool p_value                      ) noexcept { m_insecure           = p_value;                                return *this; }
+  Options & maxredirs         ( long p_value                      ) noexcept { m_maxredirs          = p_value;                                return *this; }
+  Options & pipewait          ( bool p_value                      ) noexcept { m_pipewait           = p_value;                                return *this; }
+  Options & proxy             ( std::string p_value               )          { m_proxy              = std::move( p_value );                   return *this; }
+  Options & rcpt_allow_fails  ( bool p_value                      ) noexcept { m_rcpt_allow_fails   = p_value;                                return *this; }
+  Options & timeout           ( std::chrono::milliseconds p_value ) noexcept { m_timeout            = static_cast< long >( p_value.count() ); return *this; }
+  Options & verbose           ( bool p_value                      ) noexcept { m_verbose            = p_value;                                return *this; }
+  //
+  // Accessors
+  std::chrono::milliseconds timeout() const noexcept { return std::chrono::milliseconds( m_timeout ); }
+  //
   // Apply options to curl easy handle
   bool apply( CURL * p_curl ) const;
   //
@@ -46,11 +69,13 @@ private:
   std::string m_proxy;
   long        m_connect_timeout    = 0;
   long        m_follow_location    = 0;
+  long        m_http_version       = CURL_HTTP_VERSION_NONE;
   long        m_maxredirs          = 0;
   long        m_timeout            = 0;
   bool        m_accept_compression = true;
   bool        m_cookies            = false;
   bool        m_insecure           = false;
+  bool        m_pipewait           = false;
   bool        m_rcpt_allow_fails   = false;
   bool        m_verbose            = false;
 };
@@ -0,0 +1,31 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <memory>
+
+#include "authentication.hpp"
+#include "certificates.hpp"
+#include "options.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// A set of options, authentication and certificates. Once created by ASync
+// it is never modified, only replaced: it is shared by pointer between the
+// protocols, which only apply it when it differs from the one already
+// applied to their easy handle.
+struct Profile
+{
+  Options        options;
+  Authentication authentication;
+  Certificates   certificates;
+};
+
+using profile_ptr = std::shared_ptr< const Profile >;
+
+} // namespace curlev
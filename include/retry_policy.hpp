@@ -0,0 +1,70 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// How a failed request is reattempted. The delay before the Nth reattempt is
+//   base_delay_ms * multiplier^(N-1), capped at max_delay_ms
+// of which a jitter fraction is randomized, so that the clients affected by
+// the same failure do not retry at the same time.
+struct retry_policy
+{
+  unsigned max_retries        = 0;      // 0: no reattempt
+  unsigned base_delay_ms      = 100;
+  unsigned max_delay_ms       = 10'000;
+  double   multiplier         = 2.0;    // 1 for a constant delay
+  double   jitter             = 1.0;    // 0: exact delay, 1: uniformly random between 0 and the delay
+  bool     honor_retry_after  = true;   // wait as asked by a Retry-After header, give up if longer than max_delay_ms
+  //
+  // If set, decides which result codes are reattempted, invoked in an ASync
+  // loop thread. By default, the codes guaranteeing that the request had
+  // no side effect: name resolution and connection failures, 429 and 503.
+  std::function< bool( long p_result_code ) > retryable;
+  //
+  // Delay before the p_attempt reattempt (starting at 1), p_random being in [0,1)
+  uint64_t delay_ms( unsigned p_attempt, double p_random ) const;
+  //
+  // Is the result code reattempted by default
+  static bool default_retryable( long p_result_code );
+};
+
+// Convert the value of a Retry-After header, in seconds or an HTTP date,
+// to a delay from p_now (in seconds since the epoch). Returns false if invalid.
+bool parse_retry_after( std::string_view p_value, int64_t p_now, uint64_t & p_delay_ms );
+
+//--------------------------------------------------------------------
+// A token bucket limiting the reattempts to a fraction of the traffic:
+// each new request deposits p_ratio token, each reattempt withdraws one,
+// and p_min_per_second tokens are added each second so that a low traffic
+// can still be reattempted. The bucket holds at most p_capacity tokens.
+// It is only used by a single thread.
+class retry_budget
+{
+public:
+  void configure( double p_ratio, double p_min_per_second, double p_capacity );
+  //
+  // Nothing is limited until configured
+  bool enabled() const noexcept { return m_capacity > 0; }
+  //
+  void deposit () noexcept;
+  bool withdraw( uint64_t p_now_ms ) noexcept; // false if no token is available
+  //
+private:
+  double   m_ratio          = 0;
+  double   m_min_per_second = 0;
+  double   m_capacity       = 0;
+  double   m_tokens         = 0;
+  uint64_t m_last_ms        = 0; // last refill by m_min_per_second
+};
+
+} // namespace curlev
@@ -82,15 +82,21 @@ public:
   //
   struct response
   {
-    long code = 0;
+    long            code = 0;
+    curlev::timings timings;
   };
   //
   std::future< response > launch();
   //
 protected:
+  friend class Wrapper< SMTP >;
+  //
   // Prevent creating directly an instance of the class, the Wrapper::create() method must be used
   explicit SMTP( ASync & p_async ) : Wrapper< SMTP >( p_async, "smtp,smtps" ) {};
   //
+  // Move the received data into a response, once the transfer is finished
+  response take_response();
+  //
   // Called by Wrapper before starting a request
   bool prepare_protocol() override;
   //
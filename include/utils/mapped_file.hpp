@@ -0,0 +1,39 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "utils/non_transferable.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// A read-only memory mapping of a whole file, released on destruction
+class mapped_file : private non_transferable
+{
+public:
+  mapped_file() = default;
+  ~mapped_file() override;
+  //
+  // Map the file, releasing a previous mapping. Returns false on error.
+  bool open( const std::string & p_path );
+  //
+  // Release the mapping, ok if not mapped
+  void close();
+  //
+  // Accessors. An empty file has no data.
+  const char * data() const { return m_data; }
+  size_t       size() const { return m_size; }
+  //
+private:
+  char * m_data = nullptr;
+  size_t m_size = 0;
+};
+
+} // namespace curlev
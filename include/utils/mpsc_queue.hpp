@@ -0,0 +1,98 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "utils/non_transferable.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// A lock-free, multi-producers single-consumer queue.
+// Producers push items one by one (Treiber stack), the consumer takes
+// all pending items at once and processes them in the order they were pushed.
+template < typename T >
+class mpsc_queue : private non_transferable
+{
+public:
+  mpsc_queue() = default;
+  //
+  ~mpsc_queue() override
+  {
+    consume( []( T && ) {} ); // free remaining items
+  }
+  //
+  // Add an item, can be called by any thread.
+  // Returns false on memory error.
+  bool push( T p_value )
+  {
+    auto * item = new ( std::nothrow ) node{ std::move( p_value ), nullptr };
+    if ( item == nullptr )
+      return false;
+    //
+    item->next = m_head.load( std::memory_order_relaxed );
+    //
+    while ( ! m_head.compare_exchange_weak( item->next, item,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed ) )
+      ;
+    //
+    return true;
+  }
+  //
+  // Retrieve all pending items and invoke p_action on each of them, in FIFO order.
+  // Must only be called by one thread at a time.
+  // Returns the number of processed items.
+  template < typename Callable >
+  size_t consume( Callable && p_action )
+  {
+    node * pending = m_head.exchange( nullptr, std::memory_order_acquire );
+    node * ordered = nullptr;
+    //
+    // The stack is in LIFO order: reverse it
+    while ( pending != nullptr )
+    {
+      auto * next   = pending->next;
+      pending->next = ordered;
+      ordered       = pending;
+      pending       = next;
+    }
+    //
+    size_t count = 0;
+    //
+    while ( ordered != nullptr )
+    {
+      auto * next = ordered->next;
+      //
+      p_action( std::move( ordered->value ) );
+      delete ordered;
+      //
+      ordered = next;
+      count++;
+    }
+    //
+    return count;
+  }
+  //
+  // Accessors
+  bool empty() const { return m_head.load( std::memory_order_acquire ) == nullptr; }
+  //
+private:
+  struct node
+  {
+    T      value;
+    node * next;
+  };
+  //
+  std::atomic< node * > m_head = nullptr;
+};
+
+} // namespace curlev
@@ -54,4 +54,7 @@ bool parse_cskv( std::string_view p_cskv, Callable && p_handler )
 // Checks if the given string can be safely added in an header
 bool is_safe_header_component( std::string_view p_string );
 
+// Extracts the origin of an URL: its scheme, host and port, lower cased, without user info
+std::string url_origin( std::string_view p_url );
+
 } // namespace curlev
@@ -5,16 +5,30 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <condition_variable>
 #include <curl/curl.h>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include( <coroutine> )
+  #include <coroutine>
+#endif
 
 #include "async.hpp"
+#include "body_source.hpp"
+#include "retry_policy.hpp"
 #include "utils/assert_return.hpp"
 #include "utils/curl_utils.hpp"
 #include "utils/map_utils.hpp"
+#include "utils/string_utils.hpp"
 
 namespace curlev
 {
@@ -33,6 +47,7 @@ constexpr long c_error_certificates_set           = -23; // bad certificates val
 constexpr long c_error_options_format             = -24; // bad options format string
 constexpr long c_error_options_set                = -25; // bad option value
 constexpr long c_error_safe_protocols_set         = -26; // bad protocols
+constexpr long c_error_profile_unknown            = -27; // profile not defined in ASync
 
 constexpr long c_error_user_callback              = -30; // callback crashed
 constexpr long c_error_url_set                    = -31; // error setting URL (and method/parameters)
@@ -40,19 +55,43 @@ constexpr long c_error_headers_set                = -32; // error adding headers
 constexpr long c_error_body_set                   = -33; // error adding body
 constexpr long c_error_mime_set                   = -34; // error adding MIME body
 constexpr long c_error_recipients_set             = -35; // error adding recipients
+constexpr long c_error_response_file_set          = -36; // error opening the response file
+
+constexpr long c_error_circuit_open               = -40; // the circuit breaker of the origin is open
+constexpr long c_error_deadline                   = -41; // the deadline expired before the request started
 
 // The default maximal received response size
 constexpr auto c_default_response_size_max        = 2'000'000;
 
-// When retrying failed requests, the default number of retries
-// and delay between retries
-constexpr auto c_default_retries_max              = 0U;
-constexpr auto c_default_retries_delay_ms         = 100U;
+//--------------------------------------------------------------------
+// Durations of the phases of a transfer, in microseconds.
+// Except queue, they are cumulative from the start of the transfer by libcurl,
+// see CURLINFO_*_TIME_T.
+struct timings
+{
+  uint64_t queue         = 0; // from start() to the transfer start by ASync uv thread
+  uint64_t namelookup    = 0; // name resolved
+  uint64_t connect       = 0; // connected to the host or proxy
+  uint64_t appconnect    = 0; // SSL/SSH handshake completed
+  uint64_t pretransfer   = 0; // about to transfer
+  uint64_t starttransfer = 0; // first byte received
+  uint64_t total         = 0; // transfer finished
+  uint64_t redirect      = 0; // all redirection steps, before the final transaction
+};
+
+// Returned while the transfer is running
+inline constexpr timings c_empty_timings{};
 
 //--------------------------------------------------------------------
 // The base class is the one known and called by ASync
 class WrapperBase : private non_transferable
 {
+public:
+  ~WrapperBase() override
+  {
+    close_response_fd();
+  }
+  //
 protected:
   friend class ASync;
   //
@@ -65,16 +104,20 @@ protected:
   // Maximum size of the body that ASync will receive
   virtual size_t get_max_response_size() const = 0;
   //
-  // If restarting a request, the delay before the reattempt
-  virtual uint64_t get_retry_delay_ms() const = 0;
+  // How a failed request is reattempted
+  virtual const retry_policy & get_retry_policy() const = 0;
   //
-  // Return true if a failed request can be retried
-  virtual bool can_reattempt() = 0;
+  // Timeout of an attempt, without deadline
+  virtual long get_timeout_ms() const = 0;
   //
   // Accessors
   const std::string &   request_body()     const { return m_request_body;     }
+  const body_source *   request_source()   const { return m_request_source.get(); }
+  uint64_t              queue_duration_us() const { return m_queue_us; }
   const key_values_ci & response_headers() const { return m_response_headers; }
   const std::string &   response_body()    const { return m_response_body;    }
+  const std::string &   request_origin()   const { return m_origin;           }
+  priority_level        request_priority() const { return m_priority;         }
   //
   // Mutators
   void set_request_body( const std::string & p_body )
@@ -89,6 +132,46 @@ protected:
     m_request_body_sent = 0;
   }
   //
+  void set_request_source( std::unique_ptr< body_source > && p_source )
+  {
+    m_request_source = std::move( p_source );
+  }
+  //
+  void set_request_origin( std::string && p_origin )
+  {
+    m_origin = std::move( p_origin );
+  }
+  //
+  void set_request_priority( priority_level p_priority )
+  {
+    m_priority = p_priority;
+  }
+  //
+  // The deadline is converted to the clock of uv_hrtime(), a past deadline
+  // being the current time
+  void set_request_deadline( std::chrono::steady_clock::time_point p_deadline )
+  {
+    auto remaining = std::chrono::duration_cast< std::chrono::nanoseconds >( p_deadline - std::chrono::steady_clock::now() );
+    //
+    m_deadline_ns = uv_hrtime() + static_cast< uint64_t >( std::max( remaining, std::chrono::nanoseconds::zero() ).count() );
+  }
+  //
+  bool deadline_expired() const
+  {
+    return m_deadline_ns != 0 && uv_hrtime() >= m_deadline_ns;
+  }
+  //
+  // Hedge the request after p_after_ms, or after the percentile of the latency if p_percentile is set
+  void set_request_hedge( uint64_t p_after_ms, double p_percentile, unsigned p_max_extra )
+  {
+    m_hedge.after_ms   = p_after_ms;
+    m_hedge.percentile = p_percentile;
+    m_hedge.max_extra  = p_max_extra;
+  }
+  //
+  // The duplicate handle which provided the response of a hedged request, nullptr if none
+  CURL * hedge_winner() const { return m_hedge.winner_curl; }
+  //
   void take_response_headers( key_values_ci & p_headers )
   {
     p_headers = std::move( m_response_headers );
@@ -99,29 +182,159 @@ protected:
     p_body = std::move( m_response_body );
   }
   //
+  // Optional receiver of the response body, called by ASync as data arrives instead
+  // of storing it in m_response_body. It returns false to pause the transfer: the same
+  // data is then passed again once the transfer is resumed.
+  using body_receiver = std::function< bool( std::string_view ) >;
+  //
+  void set_response_receiver( body_receiver && p_receiver )
+  {
+    m_response_receiver = std::move( p_receiver );
+  }
+  //
+  // Optional file descriptor receiving the response body instead of m_response_body.
+  // If owned, it is closed once the transfer is finished.
+  void set_response_fd( int p_fd, bool p_owned )
+  {
+    close_response_fd();
+    //
+    m_response_fd       = p_fd;
+    m_response_fd_owned = p_owned;
+    m_response_fd_start = p_fd >= 0 ? lseek( p_fd, 0, SEEK_CUR ) : -1; // -1 if not seekable (pipe, socket...)
+  }
+  //
+  void close_response_fd()
+  {
+    if ( m_response_fd >= 0 && m_response_fd_owned )
+      close( m_response_fd );
+    //
+    m_response_fd       = -1;
+    m_response_fd_owned = false;
+  }
+  //
+  // Can a partially received response be discarded: it was not passed to
+  // m_response_receiver nor written to a non seekable m_response_fd
+  bool response_rewindable() const
+  {
+    return m_response_received == 0 || ( m_response_receiver == nullptr && ( m_response_fd < 0 || m_response_fd_start >= 0 ) );
+  }
+  //
+  // Called by ASync before reattempting a request: libcurl reads the body again from where
+  // the previous attempt stopped. Returns false if the source cannot be rewound.
+  bool rewind_request()
+  {
+    m_request_body_sent = 0;
+    //
+    if ( m_request_source == nullptr )
+      return true;
+    //
+    try
+    {
+      return m_request_source->seek( 0 );
+    }
+    catch ( ... )
+    {
+      return false;
+    }
+  }
+  //
+  // Called by ASync before reattempting a request, to discard a partially received response.
+  // Returns false if the file cannot be truncated: the request must then fail.
+  bool reset_response()
+  {
+    m_response_headers.clear();
+    m_response_body   .clear();
+    m_header_content_length = 0;
+    //
+    if ( m_response_fd >= 0 && m_response_fd_start >= 0 && m_response_received > 0 )
+    {
+      if ( ftruncate( m_response_fd, m_response_fd_start ) != 0 ||
+           lseek    ( m_response_fd, m_response_fd_start, SEEK_SET ) < 0 )
+        return false;
+    }
+    //
+    m_response_received = 0;
+    return true;
+  }
+  //
   // Called byw Wrapper to reset the protocol before starting a new transfer
   void clear_base()
   {
     m_request_body    .clear();
+    m_request_source  .reset();
     m_response_headers.clear();
     m_response_body   .clear();
     m_request_body_sent     = 0;
     m_header_content_length = 0;
+    m_response_receiver     = nullptr;
+    m_response_received     = 0;
+    m_reattempts            = 0;
+    m_retry_abort_code      = CURLE_ABORTED_BY_CALLBACK;
+    m_host_slot             = false;
+    m_priority              = priority_level::normal;
+    m_deadline_ns           = 0;
+    m_hedge                 = {}; // releases the winner
+    m_origin.clear();
+    close_response_fd();
   }
   //
 private:
   // Data sent during transfer by ASync's callbacks
-  std::string   m_request_body;               // must be persistent (CURLOPT_READDATA)
-  size_t        m_request_body_sent = 0;      // already sent
+  std::string                    m_request_body;          // must be persistent (CURLOPT_READDATA)
+  size_t                         m_request_body_sent = 0; // already sent
+  std::unique_ptr< body_source > m_request_source;        // if set, replaces m_request_body
   //
   // Data received during transfer by ASync's callbacks
   key_values_ci m_response_headers;           // must be persistent (CURLOPT_HEADERDATA)
   std::string   m_response_body;              // must be persistent (CURLOPT_WRITEDATA)
   size_t        m_header_content_length = 0;  // set to the received Content-Length header, if received; reset when receiving body
+  body_receiver m_response_receiver;          // if set, replaces m_response_body
+  size_t        m_response_received     = 0;  // size passed to m_response_receiver or written to m_response_fd
+  int           m_response_fd           = -1; // if set, replaces m_response_body
+  bool          m_response_fd_owned     = false;
+  off_t         m_response_fd_start     = -1; // initial offset in m_response_fd, -1 if not seekable
   //
   // Timer used to control the delay before a failed request re-attempt.
   // Set by ASync::get_handle; its data is the curl handle
-  uv_timer_t m_retry_uv_timer = {};
+  uv_timer_t m_retry_uv_timer   = {};
+  unsigned   m_reattempts       = 0;                         // of the current request, counted by ASync
+  long       m_retry_abort_code = CURLE_ABORTED_BY_CALLBACK; // notified when the reattempt is cancelled
+  //
+  // The ASync shard executing the request, set by ASync::start_request
+  unsigned   m_async_shard    = 0;
+  //
+  // Origin of the request URL, only set if ASync has circuit breakers or host limits
+  std::string m_origin;
+  bool        m_host_slot = false; // an in-flight slot of the origin's host limiter is held
+  //
+  // Order of the request in the host limiters and the callback queues
+  priority_level m_priority = priority_level::normal;
+  //
+  // Deadline of the request, reattempts included, in uv_hrtime() clock; 0 if none
+  uint64_t m_deadline_ns = 0;
+  //
+  // Hedging, see HTTP::hedge. Used by ASync on a primary request for the
+  // settings, the duplicates running, the result waiting for them and the
+  // duplicate which won; on a duplicate to find its primary.
+  struct hedging
+  {
+    uint64_t                       after_ms    = 0;
+    double                         percentile  = 0;       // replaces after_ms if set
+    unsigned                       max_extra   = 0;       // 0: not hedged
+    unsigned                       started     = 0;       // duplicates started
+    uint64_t                       delay_ms    = 0;       // between duplicates, set when the request starts
+    uint64_t                       due_ms      = 0;       // uv_now() of the next duplicate, 0 if none
+    std::vector< CURL * >          running;               // duplicates running
+    bool                           parked      = false;   // the primary failed, waiting for the duplicates
+    long                           parked_code = 0;
+    std::shared_ptr< WrapperBase > winner;                // keeps winner_curl until the next request
+    CURL *                         winner_curl = nullptr;
+    CURL *                         primary     = nullptr; // set on a duplicate
+  } m_hedge;
+  //
+  // When the request was queued by ASync::start_request, and the time spent in the queue
+  uint64_t   m_queued_ns      = 0;
+  uint64_t   m_queue_us       = 0;
 };
 
 //--------------------------------------------------------------------
@@ -153,13 +366,14 @@ class Wrapper: public WrapperBase
     //
     explicit Wrapper( ASync & p_async, std::string p_safe_protocols ) :
       WrapperBase     (),
+      m_profile       ( p_async.get_default() ),
       m_safe_protocols( std::move( p_safe_protocols ) ),
       m_async         ( p_async )
     {}
     //
     ~Wrapper() override
     {
-      ASync::return_handle( m_curl );
+      m_async.return_handle( m_curl );
     }
     //
     // The factory. The invoker takes the ownership of the new class, but
@@ -187,35 +401,15 @@ class Wrapper: public WrapperBase
       {
         std::lock_guard lock( m_exec_mutex );
         //
-        if ( m_exec_state != State::idle )              // already running: do nothing at all
+        if ( m_exec_state != State::idle )                                // already running: do nothing at all
           return static_cast< Protocol & >( *this );
         //
-        m_user_cb = std::move( p_user_cb );             // will be cleared by cb_protocol (below or in async_cb)
-        //
-        if ( m_response_code == c_success )             // initialization succeeded
+        if ( auto * cb_data = prepare_start( std::move( p_user_cb ) ); cb_data != nullptr )
         {
-          if ( prepare_protocol() && prepare_local() )  // set m_response_code on error
-          {
-            if ( auto self = m_self_weak.lock() )       // must succeed since we are invoked
-            {
-              auto cb_data = new std::shared_ptr< Protocol >( self ); // a new shared_ptr for ASync, deleted by ASync
-              m_exec_state = State::running;                          // will be cleared in async_cb called by ASync
-              //
-              if ( m_async.start_request( m_curl, cb_data ) )         // ASync processing starts here
-                  return static_cast< Protocol & >( *this );
-              //
-              m_exec_state = State::idle;                             // ASync failed
-              delete cb_data;
-            }
-            else
-            {
-              assert( false );
-            }
-            //
-            m_response_code = c_error_internal_start;
-          }
+          if ( m_async.start_request( m_curl, cb_data ) )                 // ASync processing starts here
+            return static_cast< Protocol & >( *this );
           //
-          // feat(erase_memory_secrets): m_authentication, m_certificates, m_options?
+          cancel_start( cb_data );                                        // ASync failed
         }
       }
       //
@@ -224,6 +418,105 @@ class Wrapper: public WrapperBase
       return static_cast< Protocol & >( *this );
     }
     //
+    // To start several transfers asynchronously, submitting them to ASync at once.
+    // The optional callback is invoked for each of them.
+    // Transfers already running are ignored, and those created with another ASync
+    // than the first one are started individually.
+    static void start_batch( const std::vector< std::shared_ptr< Protocol > > & p_batch,
+                             const cb_user &                                    p_user_cb = nullptr )
+    {
+      std::vector< std::pair< CURL *, void * > > requests;
+      std::vector< Wrapper * >                   prepared; // same order as requests
+      std::vector< Wrapper * >                   failed;   // the user's callbacks must be invoked
+      ASync *                                    async = nullptr;
+      //
+      requests.reserve( p_batch.size() );
+      prepared.reserve( p_batch.size() );
+      //
+      for ( const auto & protocol : p_batch )
+      {
+        Wrapper * wrapper = protocol.get();
+        //
+        if ( wrapper == nullptr )
+          continue;
+        //
+        if ( async == nullptr )
+          async = &wrapper->m_async;
+        //
+        if ( async != &wrapper->m_async )
+        {
+          wrapper->start( cb_user( p_user_cb ) );
+          continue;
+        }
+        //
+        std::lock_guard lock( wrapper->m_exec_mutex );
+        //
+        if ( wrapper->m_exec_state != State::idle ) // already running: do nothing at all
+          continue;
+        //
+        if ( auto * cb_data = wrapper->prepare_start( cb_user( p_user_cb ) ); cb_data != nullptr )
+        {
+          requests.emplace_back( wrapper->m_curl, cb_data );
+          prepared.push_back( wrapper );
+        }
+        else
+        {
+          failed.push_back( wrapper );
+        }
+      }
+      //
+      // ASync processing starts here
+      auto started = async != nullptr ? async->start_requests( requests ) : 0;
+      //
+      for ( auto index = started; index < requests.size(); index++ ) // ASync failed
+      {
+        {
+          std::lock_guard lock( prepared[ index ]->m_exec_mutex );
+          prepared[ index ]->cancel_start( requests[ index ].second );
+        }
+        failed.push_back( prepared[ index ] );
+      }
+      //
+      for ( auto * wrapper : failed )
+        wrapper->cb_protocol(); // invoke user's callback (outside of the lock), clear m_user_cb
+    }
+    //
+    #if __cplusplus >= 202002L && __has_include( <coroutine> )
+      // Awaitable returned by async()
+      class awaiter
+      {
+        public:
+          explicit awaiter( Wrapper & p_wrapper ) : m_wrapper( p_wrapper ) {}
+          //
+          bool await_ready() const noexcept { return false; }
+          //
+          // Returns false if the transfer did not start: the coroutine continues immediately
+          bool await_suspend( std::coroutine_handle<> p_handle )
+          {
+            // The coroutine may be resumed before start_and_resume returns: members must not be accessed after
+            return m_wrapper.start_and_resume(
+                []( void * p_address ) { std::coroutine_handle<>::from_address( p_address ).resume(); },
+                p_handle.address() );
+          }
+          //
+          auto await_resume()
+          {
+            return m_wrapper.take_response_if_idle();
+          }
+          //
+        private:
+          Wrapper & m_wrapper;
+      };
+      //
+      // To start a transfer from a coroutine: co_await http->GET( url ).async()
+      // returns the Protocol response. The coroutine is resumed by a callback thread,
+      // or by the ASync uv thread if threaded_callback( false ) is used.
+      [[nodiscard]] awaiter async()
+      {
+        return awaiter( *this );
+      }
+    #endif
+    //
     // Wait for the end of the asynchronous transfer (after start())
     Protocol & join()
     {
@@ -246,7 +539,16 @@ class Wrapper: public WrapperBase
     Protocol & abort()
     {
       if ( is_running() )
-        m_async.abort_request( m_curl );
+        m_async.abort_request( this, m_curl );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
+    // Resume current request, paused by its body receiver
+    Protocol & resume()
+    {
+      if ( is_running() )
+        m_async.resume_request( this, m_curl );
       //
       return static_cast< Protocol & >( *this );
     }
@@ -256,37 +558,96 @@ class Wrapper: public WrapperBase
     {
       do_if_idle( [ & ]() {
         if ( m_response_code == c_success )
-          if ( ! m_options.set( p_options ) )
+          if ( ! local_profile().options.set( p_options ) )
             m_response_code = c_error_options_format;
       } );
       //
       return static_cast< Protocol & >( *this );
     }
     //
+    // Same, using the typed setters of Options instead of a string. Example:
+    //   options( []( Options & p_options ) { p_options.timeout( 500ms ); } )
+    template < typename Setter, typename = std::enable_if_t< std::is_invocable_v< Setter, Options & > > >
+    Protocol & options( Setter && p_setter )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+          std::forward< Setter >( p_setter )( local_profile().options );
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
     // Set easy libcurl credential
     Protocol & authentication( const std::string & p_credential )
     {
       do_if_idle( [ & ]() {
         if ( m_response_code == c_success )
-          if ( ! m_authentication.set( p_credential ) )
+          if ( ! local_profile().authentication.set( p_credential ) )
             m_response_code = c_error_authentication_format;
       } );
       //
       return static_cast< Protocol & >( *this );
     }
     //
+    // Same, using the typed setters of Authentication instead of a string
+    template < typename Setter, typename = std::enable_if_t< std::is_invocable_v< Setter, Authentication & > > >
+    Protocol & authentication( Setter && p_setter )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+          std::forward< Setter >( p_setter )( local_profile().authentication );
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
     // Set easy libcurl certificates
     Protocol & certificates( const std::string & p_certificates )
     {
       do_if_idle( [ & ]() {
         if ( m_response_code == c_success )
-          if ( ! m_certificates.set( p_certificates ) )
+          if ( ! local_profile().certificates.set( p_certificates ) )
             m_response_code = c_error_certificates_format;
       } );
       //
       return static_cast< Protocol & >( *this );
     }
     //
+    // Same, using the typed setters of Certificates instead of a string
+    template < typename Setter, typename = std::enable_if_t< std::is_invocable_v< Setter, Certificates & > > >
+    Protocol & certificates( Setter && p_setter )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+          std::forward< Setter >( p_setter )( local_profile().certificates );
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
+    // Use a profile defined by ASync::define_profile instead of the defaults.
+    // Options, authentication or certificates set before are discarded.
+    Protocol & profile( const std::string & p_name )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+        {
+          if ( auto profile = m_async.get_profile( p_name ); profile != nullptr )
+          {
+            m_profile       = std::move( profile );
+            m_profile_local = nullptr;
+          }
+          else
+          {
+            m_response_code = c_error_profile_unknown;
+          }
+        }
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
     // Set the callback mode (default true: threaded)
     Protocol & threaded_callback( bool p_mode )
     {
@@ -309,15 +670,54 @@ class Wrapper: public WrapperBase
       return static_cast< Protocol & >( *this );
     }
     //
-    // Set the maximal number of retries and delay between retries in milliseconds
+    // Set the maximal number of retries and a constant delay between retries in milliseconds
     Protocol & maximum_retries(unsigned p_retries, unsigned p_delay_ms)
+    {
+      retry_policy policy;
+      //
+      policy.max_retries       = p_retries;
+      policy.base_delay_ms     = p_delay_ms;
+      policy.max_delay_ms      = p_delay_ms;
+      policy.multiplier        = 1.0;
+      policy.jitter            = 0.0;
+      policy.honor_retry_after = false;
+      //
+      return retry( std::move( policy ) );
+    }
+    //
+    // Set the priority of the request (default normal). Requests of higher
+    // priority leave the host limits and the callback queues first, and get a
+    // larger HTTP/2 stream weight.
+    Protocol & priority( priority_level p_level )
     {
       do_if_idle( [ & ]() {
         if ( m_response_code == c_success )
-        {
-          m_retries_max      = p_retries;
-          m_retries_delay_ms = p_delay_ms;
-        }
+          set_request_priority( p_level );
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
+    // Set the time by which the request, reattempts included, must be finished
+    // (default none). Each attempt's timeout is shrunk to the remaining time,
+    // and no reattempt is scheduled past the deadline. A request not started
+    // by its deadline fails with c_error_deadline, without network access.
+    Protocol & deadline( std::chrono::steady_clock::time_point p_deadline )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+          set_request_deadline( p_deadline );
+      } );
+      //
+      return static_cast< Protocol & >( *this );
+    }
+    //
+    // Set the policy used to reattempt failed requests (default: no reattempt)
+    Protocol & retry( retry_policy p_policy )
+    {
+      do_if_idle( [ & ]() {
+        if ( m_response_code == c_success )
+          m_retry_policy = std::move( p_policy );
       } );
       //
       return static_cast< Protocol & >( *this );
@@ -335,16 +735,104 @@ class Wrapper: public WrapperBase
     }
     //
     // Accessors
-    long get_code() const noexcept { return is_running() ? c_running : m_response_code; };
+    long            get_code   () const noexcept { return is_running() ? c_running : m_response_code; };
+    const timings & get_timings() const noexcept { return is_running() ? c_empty_timings : m_timings; };
     //
   protected:
     CURL *         m_curl            = nullptr;
-    unsigned       m_request_retries = 0;
     long           m_response_code   = c_success;
-    Options        m_options;
-    Authentication m_authentication;
-    Certificates   m_certificates;
+    profile_ptr    m_profile;         // used by the next transfer
     std::string    m_safe_protocols;
+    timings        m_timings;
+    //
+    // Prepare the transfer before passing it to ASync.
+    // m_exec_state must be idle and m_exec_mutex locked.
+    // Returns the data to pass to ASync, or nullptr if the transfer cannot start:
+    // m_response_code is then set and the user's callback must be invoked.
+    void * prepare_start( cb_user && p_user_cb )
+    {
+      m_user_cb = std::move( p_user_cb );             // will be cleared by cb_protocol (in async_cb or by the caller)
+      //
+      if ( m_response_code == c_success && deadline_expired() )
+        m_response_code = c_error_deadline;           // fail fast, without preparing the request
+      //
+      if ( m_response_code == c_success && ! m_async.circuit_allows( request_origin() ) )
+        m_response_code = c_error_circuit_open;       // fail fast, without preparing the request
+      //
+      if ( m_response_code == c_success )             // initialization succeeded
+      {
+        if ( prepare_protocol() && prepare_local() )  // set m_response_code on error
+        {
+          if ( auto self = m_self_weak.lock() )       // must succeed since we are invoked
+          {
+            m_exec_state = State::running;            // will be cleared in async_cb called by ASync
+            //
+            return new std::shared_ptr< Protocol >( self ); // a new shared_ptr for ASync, deleted by ASync
+          }
+          //
+          assert( false );
+          m_response_code = c_error_internal_start;
+        }
+        //
+        // feat(erase_memory_secrets): m_profile_local?
+      }
+      //
+      return nullptr;
+    }
+    //
+    // Start a transfer with no user's callback, and invoke p_resume( p_data ) once the transfer
+    // is finished and idle. Returns false if the transfer did not start, p_resume is then not invoked.
+    bool start_and_resume( void ( * p_resume )( void * ), void * p_data )
+    {
+      std::lock_guard lock( m_exec_mutex );
+      //
+      if ( m_exec_state != State::idle ) // already running: do nothing at all
+        return false;
+      //
+      if ( auto * cb_data = prepare_start( nullptr ); cb_data != nullptr )
+      {
+        m_continuation      = p_resume;
+        m_continuation_data = p_data;
+        //
+        if ( m_async.start_request( m_curl, cb_data ) ) // ASync processing starts here
+          return true;
+        //
+        m_continuation      = nullptr;
+        m_continuation_data = nullptr;
+        //
+        cancel_start( cb_data ); // ASync failed
+      }
+      //
+      return false;
+    }
+    //
+    // Move the response out of the Protocol, or return a response with
+    // the c_running code if a transfer is running.
+    // The return type is deduced since Protocol is incomplete here.
+    auto take_response_if_idle()
+    {
+      std::lock_guard lock( m_exec_mutex );
+      //
+      if ( m_exec_state != State::idle )
+      {
+        typename Protocol::response response;
+        response.code = c_running;
+        return response;
+      }
+      //
+      return static_cast< Protocol & >( *this ).take_response();
+    }
+    //
+    // ASync failed to start the transfer prepared by prepare_start.
+    // m_exec_mutex must be locked.
+    void cancel_start( void * p_cb_data )
+    {
+      delete static_cast< std::shared_ptr< Protocol > * >( p_cb_data );
+      //
+      m_exec_state    = State::idle;
+      m_response_code = c_error_internal_start;
+      m_exec_cv.notify_one(); // in case of a join() on a batch
+    }
     //
     // Reset the protocol before starting a new transfer.
     // m_exec_state must be idle and m_exec_mutex locked (use do_if_idle).
@@ -356,19 +844,33 @@ class Wrapper: public WrapperBase
       clear_base();
       //
       // In Wrapper
-      m_request_retries   = 0;
       m_response_code     = c_success;
+      m_timings           = {};
       m_user_cb_threaded  = true;
       m_user_cb           = nullptr;
       m_response_size_max = c_default_response_size_max;
       //
-      m_async.get_default( m_options, m_authentication, m_certificates ); // restore global defaults
+      m_profile       = m_async.get_default(); // restore global defaults
+      m_profile_local = nullptr;
       //
       // In derived protocol
       clear_protocol();
     }
     //
-    // Enable m_request_body usage
+    // The handle whose transfer provided the response
+    CURL * response_handle() const
+    {
+      return hedge_winner() != nullptr ? hedge_winner() : m_curl;
+    }
+    //
+    // Remember the origin of the request URL, if used by the circuit breakers or the host limits of ASync
+    void set_url_origin( std::string_view p_url )
+    {
+      if ( m_async.uses_origin() )
+        set_request_origin( url_origin( p_url ) );
+    }
+    //
+    // Enable m_request_body or m_request_source usage
     bool prepare_request_body()
     {
       // libcurl doesn't expose the maximal value of curl_off_t (internally CURL_OFF_T_MAX )
@@ -377,35 +879,53 @@ class Wrapper: public WrapperBase
           ( static_cast< curl_off_t >( 1 ) << ( bits - 2 ) ) - 1 +
           ( static_cast< curl_off_t >( 1 ) << ( bits - 2 ) );
       //
-      bool ok = true;
+      bool       ok   = true;
+      curl_off_t size = 0; // -1 if unknown: chunked transfer encoding is used
       //
-      ok = ok && request_body().size() < max_val;
-      ok = ok && easy_setopt( m_curl, CURLOPT_UPLOAD          , 1L );
-      ok = ok && easy_setopt( m_curl, CURLOPT_INFILESIZE_LARGE, static_cast< curl_off_t >( request_body().size() ) ); // will add the Content-Length header
+      if ( const auto * source = request_source(); source != nullptr )
+      {
+        size = source->size() < 0 ? -1 : static_cast< curl_off_t >( source->size() );
+      }
+      else
+      {
+        ok   = ok && request_body().size() < max_val;
+        size = static_cast< curl_off_t >( request_body().size() );
+      }
+      //
+      ok = ok && easy_setopt( m_curl, CURLOPT_UPLOAD          , 1L   );
+      ok = ok && easy_setopt( m_curl, CURLOPT_INFILESIZE_LARGE, size ); // will add the Content-Length header
       //
       return ok;
     }
     //
     // When starting, applies the local configuration.
     // It is guaranteed that there is no operation running.
+    // The profile is only applied if it is not the one already applied to the handle.
     bool prepare_local()
     {
-      if ( ! m_options.apply( m_curl ) )
-      {
-        m_response_code = c_error_options_set;
-        return false;
-      }
-      //
-      if ( ! m_authentication.apply( m_curl ) )
-      {
-        m_response_code = c_error_authentication_set;
-        return false;
-      }
-      //
-      if ( ! m_certificates.apply( m_curl ) )
+      if ( m_profile != m_profile_applied )
       {
-        m_response_code = c_error_certificates_set;
-        return false;
+        m_profile_applied = nullptr; // the handle is partially configured until success
+        //
+        if ( ! m_profile->options.apply( m_curl ) )
+        {
+          m_response_code = c_error_options_set;
+          return false;
+        }
+        //
+        if ( ! m_profile->authentication.apply( m_curl ) )
+        {
+          m_response_code = c_error_authentication_set;
+          return false;
+        }
+        //
+        if ( ! m_profile->certificates.apply( m_curl ) )
+        {
+          m_response_code = c_error_certificates_set;
+          return false;
+        }
+        //
+        m_profile_applied = m_profile;
       }
       //
       if ( ! easy_setopt( m_curl, CURLOPT_PROTOCOLS_STR      , m_safe_protocols.c_str() ) ||
@@ -415,6 +935,10 @@ class Wrapper: public WrapperBase
         return false;
       }
       //
+      // Only used by HTTP/2, fails if libcurl does not support it
+      constexpr std::array< long, c_priority_levels > stream_weights = { 256, 16, 1 }; // 16 is the default  NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      curl_easy_setopt( m_curl, CURLOPT_STREAM_WEIGHT, stream_weights[ static_cast< size_t >( request_priority() ) ] );
+      //
       return true;
     }
     //
@@ -423,7 +947,9 @@ class Wrapper: public WrapperBase
     {
       m_response_code = p_result; // before finalize, in case the Protocol needs it
       //
-      // feat(erase_memory_secrets): m_authentication, m_certificates, m_options?
+      // feat(erase_memory_secrets): m_profile_local?
+      close_response_fd(); // the received file is complete
+      finalize_timings();
       finalize_protocol(); // calls Protocol to retrieve protocol related details
       //
       {
@@ -433,13 +959,22 @@ class Wrapper: public WrapperBase
       //
       cb_protocol(); // invokes user's callback, clear m_user_cb
       //
+      void ( * continuation )( void * ) = nullptr;
+      void *   continuation_data        = nullptr;
+      //
       {
         {
           std::lock_guard lock( m_exec_mutex );
           m_exec_state = State::idle;
+          //
+          std::swap( continuation     , m_continuation      );
+          std::swap( continuation_data, m_continuation_data );
         }
         m_exec_cv.notify_one(); // releases the join(): request is now terminated
       }
+      //
+      if ( continuation != nullptr )
+        continuation( continuation_data ); // e.g. resumes the coroutine awaiting async()
     }
     //
     // Is async_cb called in ASync uv thread (false) or a dedicated thread (true)
@@ -447,7 +982,7 @@ class Wrapper: public WrapperBase
     // enough and don't use an extra thread.
     bool use_threaded_cb() const override
     {
-      return m_user_cb_threaded && m_user_cb != nullptr;
+      return m_user_cb_threaded && ( m_user_cb != nullptr || m_continuation != nullptr );
     }
     //
     // Retrieve the maximum size of the body that ASync will receive
@@ -456,16 +991,16 @@ class Wrapper: public WrapperBase
       return m_response_size_max;
     }
     //
-    // If restarting a request, the delay before the reattempt
-    uint64_t get_retry_delay_ms() const override
+    // How a failed request is reattempted
+    const retry_policy & get_retry_policy() const override
     {
-      return m_retries_delay_ms;
+      return m_retry_policy;
     }
     //
-    // Return true if a failed request can be retried
-    bool can_reattempt() override
+    // Retrieve the timeout of an attempt, applied to the handle by prepare_local
+    long get_timeout_ms() const override
     {
-      return m_request_retries++ < m_retries_max;
+      return static_cast< long >( m_profile->options.timeout().count() );
     }
     //
     // When starting, the Protocol configures the easy handle
@@ -477,6 +1012,28 @@ class Wrapper: public WrapperBase
     // When doing a clear() to reset the Protocol options
     virtual void clear_protocol() = 0;
     //
+    // Retrieve the durations of the transfer phases
+    void finalize_timings()
+    {
+      auto get = [ this ]( CURLINFO p_info, uint64_t & p_value )
+      {
+        curl_off_t value = 0;
+        //
+        if ( curl_easy_getinfo( response_handle(), p_info, &value ) == CURLE_OK && value > 0 )
+          p_value = static_cast< uint64_t >( value );
+      };
+      //
+      m_timings       = {};
+      m_timings.queue = queue_duration_us();
+      get( CURLINFO_NAMELOOKUP_TIME_T   , m_timings.namelookup    );
+      get( CURLINFO_CONNECT_TIME_T      , m_timings.connect       );
+      get( CURLINFO_APPCONNECT_TIME_T   , m_timings.appconnect    );
+      get( CURLINFO_PRETRANSFER_TIME_T  , m_timings.pretransfer   );
+      get( CURLINFO_STARTTRANSFER_TIME_T, m_timings.starttransfer );
+      get( CURLINFO_TOTAL_TIME_T        , m_timings.total         );
+      get( CURLINFO_REDIRECT_TIME_T     , m_timings.redirect      );
+    }
+    //
     // Invoke the Protocol user's callback, clear m_user_cb
     void cb_protocol()
     {
@@ -538,10 +1095,31 @@ class Wrapper: public WrapperBase
     bool    m_user_cb_threaded  = true;
     cb_user m_user_cb           = nullptr;
     //
+    // Optional function invoked after async_cb, once the transfer is idle (see async())
+    void ( * m_continuation )( void * ) = nullptr;
+    void *   m_continuation_data        = nullptr;
+    //
+    // A private copy of m_profile modified by options(), authentication() and
+    // certificates(), and the profile applied to m_curl by the last transfer
+    std::shared_ptr< Profile > m_profile_local;
+    profile_ptr                m_profile_applied;
+    //
+    // Create m_profile_local on the first modification after a clear(), or
+    // after it has been applied: the handle would not be updated otherwise
+    Profile & local_profile()
+    {
+      if ( m_profile_local == nullptr || m_profile_local == m_profile_applied )
+      {
+        m_profile_local = std::make_shared< Profile >( *m_profile );
+        m_profile       = m_profile_local;
+      }
+      //
+      return *m_profile_local;
+    }
+    //
     // Options
-    size_t   m_response_size_max = c_default_response_size_max;
-    unsigned m_retries_max       = c_default_retries_max;
-    unsigned m_retries_delay_ms  = c_default_retries_delay_ms;
+    size_t       m_response_size_max = c_default_response_size_max;
+    retry_policy m_retry_policy;
 };
 
 } // namespace curlev
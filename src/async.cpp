@@ -3,10 +3,15 @@
  * SPDX-License-Identifier: Apache-2.0
  ********************************************************************/
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
+#include <fcntl.h>
 #include <map>
 #include <string>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <vector>
 
 #include "async.hpp"
@@ -30,9 +35,6 @@ namespace
   // Short sleep delay when doing active wait
   constexpr auto c_short_wait_ms      = 10U;
 
-  // Some magic values: it is possible to start around 300req/ms in curl_multi_add_handle()
-  constexpr auto c_requests_per_ms    = 300U;
-
   // Cleanly close and deallocate a loop
   void uv_clear_loop( uv_loop_t *& p_loop )
   {
@@ -48,10 +50,7 @@ namespace
 } // namespace
 
 //--------------------------------------------------------------------
-ASync::ASync()
-{
-  m_uv_timer.data = nullptr;
-}
+ASync::ASync() = default;
 
 //--------------------------------------------------------------------
 ASync::~ASync()
@@ -61,23 +60,57 @@ ASync::~ASync()
 
 //--------------------------------------------------------------------
 // Must be called at least once before calling any other function of curlev.
-// Start curl, share and multi, then UV and its worker thread.
-bool ASync::start()
+// Start curl and share, then for each shard multi, UV and its worker thread.
+// Connections are not shared: each multi handle has its own connection
+// cache, where the multi options limits are enforced.
+bool ASync::start( unsigned p_loops, unsigned p_callback_threads )
 {
   if ( m_uv_running )
     return true;
   //
+  if ( ! m_shards.empty() ) // a previous start failed, stop must be called
+    return false;
+  //
+  for ( unsigned index = 0; index < std::max( p_loops, 1U ); index++ )
+  {
+    m_shards.emplace_back( std::make_unique< shard >( *this, index ) );
+    m_shards.back()->retry_tokens.configure( m_retry_budget_ratio, m_retry_budget_per_second, m_retry_budget_capacity );
+    //
+    for ( const auto & [ origin, limits ] : m_host_limits )
+      m_shards.back()->limiters.emplace( origin, host_limiter( limits ) );
+  }
+  //
   bool ok = true;
   //
   ok = ok && global_init();
   ok = ok && share_init();
-  ok = ok && multi_init();
-  ok = ok && uv_init(); // set m_uv_running to true
-  ok = ok && cb_init(); // set m_cb_running to true
   //
-  m_default_options       .set_default();
-  m_default_authentication.set_default();
-  m_default_certificates  .set_default( m_global_ca_info, m_global_ca_path );
+  pool_init();
+  //
+  m_uv_running = true; // before starting the worker threads
+  //
+  for ( auto & loop : m_shards )
+  {
+    ok = ok && multi_init( *loop );
+    ok = ok && uv_init   ( *loop );
+  }
+  //
+  m_uv_running = ok;
+  //
+  ok = ok && cb_init( p_callback_threads ); // set m_cb_running to true
+  //
+  auto profile = std::make_shared< Profile >();
+  //
+  profile->options       .set_default();
+  profile->authentication.set_default();
+  profile->certificates  .set_default( m_global_ca_info, m_global_ca_path );
+  //
+  {
+    std::unique_lock lock( m_default_locks );
+    //
+    m_default_profile = std::move( profile );
+    m_profiles.clear();
+  }
   //
   return ok;
 }
@@ -99,57 +132,172 @@ bool ASync::stop( unsigned p_timeout_ms )
     wait_pending_requests( c_default_network_timeout_ms );
   }
   //
-  uv_clear();
+  m_uv_running = false;
+  //
+  for ( auto & loop : m_shards )
+    uv_clear( *loop );
+  //
   cb_clear();
+  pool_clear(); // pooled handles reference the share
   share_clear();
-  multi_clear();
+  //
+  for ( auto & loop : m_shards )
+    multi_clear( *loop );
+  //
+  m_shards.clear();
   global_clear();
   //
   return forced;
 }
 
 //--------------------------------------------------------------------
-// Setting default values for options, authentication and certificates
+// Setting default values for options, authentication and certificates.
+// The protocols may be using the current default profile: a modified
+// copy replaces it, and is only kept if the string is valid.
 bool ASync::options( const std::string & p_options )
 {
   std::unique_lock lock( m_default_locks );
   //
-  return m_default_options.set( p_options );
+  auto profile = std::make_shared< Profile >( *m_default_profile );
+  if ( ! profile->options.set( p_options ) )
+    return false;
+  //
+  m_default_profile = std::move( profile );
+  return true;
 }
 
 bool ASync::authentication( const std::string & p_credential )
 {
   std::unique_lock lock( m_default_locks );
   //
-  return m_default_authentication.set( p_credential );
+  auto profile = std::make_shared< Profile >( *m_default_profile );
+  if ( ! profile->authentication.set( p_credential ) )
+    return false;
+  //
+  m_default_profile = std::move( profile );
+  return true;
 }
 
 bool ASync::certificates( const std::string & p_certificates )
 {
   std::unique_lock lock( m_default_locks );
   //
-  return m_default_certificates.set( p_certificates );
+  auto profile = std::make_shared< Profile >( *m_default_profile );
+  if ( ! profile->certificates.set( p_certificates ) )
+    return false;
+  //
+  m_default_profile = std::move( profile );
+  return true;
 }
 
 //--------------------------------------------------------------------
-// Retrieve the current default options and authentication
-void ASync::get_default( Options & p_options, Authentication & p_authentication, Certificates & p_certificates ) const
+// The profile is built from the current defaults, then applied once to
+// a scratch easy handle to also validate the values, not only the format.
+bool ASync::define_profile( const std::string & p_name,
+                            const std::string & p_options,
+                            const std::string & p_credential,
+                            const std::string & p_certificates )
+{
+  if ( ! m_uv_running )
+    return false;
+  //
+  auto profile = std::make_shared< Profile >( *get_default() );
+  bool ok      = true;
+  //
+  ok = ok && profile->options       .set( p_options      );
+  ok = ok && profile->authentication.set( p_credential   );
+  ok = ok && profile->certificates  .set( p_certificates );
+  //
+  if ( ok )
+  {
+    CURL * curl = curl_easy_init();
+    //
+    ok = ok && curl != nullptr;
+    ok = ok && profile->options       .apply( curl );
+    ok = ok && profile->authentication.apply( curl );
+    ok = ok && profile->certificates  .apply( curl );
+    //
+    if ( curl != nullptr )
+      curl_easy_cleanup( curl );
+  }
+  //
+  if ( ok )
+  {
+    std::unique_lock lock( m_default_locks );
+    //
+    m_profiles[ p_name ] = std::move( profile );
+  }
+  //
+  return ok;
+}
+
+//--------------------------------------------------------------------
+// Setting the multi options. If the loops are running they are asked
+// to apply them.
+bool ASync::multi_options( const std::string & p_multi_options )
+{
+  {
+    std::unique_lock lock( m_default_locks );
+    //
+    if ( ! m_default_multi_options.set( p_multi_options ) )
+      return false;
+  }
+  //
+  if ( m_uv_running )
+    for ( auto & loop : m_shards )
+      send_command( *loop, command::configure, nullptr );
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Retrieve the current default profile, or a named one
+profile_ptr ASync::get_default() const
+{
+  std::shared_lock lock( m_default_locks );
+  //
+  return m_default_profile;
+}
+
+profile_ptr ASync::get_profile( const std::string & p_name ) const
 {
   std::shared_lock lock( m_default_locks );
   //
-  p_options        = m_default_options;
-  p_authentication = m_default_authentication;
-  p_certificates   = m_default_certificates;
+  auto found = m_profiles.find( p_name );
+  //
+  return found == m_profiles.end() ? nullptr : found->second;
 }
 
 //--------------------------------------------------------------------
 // Create a new easy handle that *must* be freed using return_handle().
-CURL * ASync::get_handle( WrapperBase * p_protocol ) const
+// A handle from the pool is used if possible, it has been reset by
+// return_handle() so the base options must be set again.
+CURL * ASync::get_handle( WrapperBase * p_protocol )
 {
   ASSERT_RETURN( p_protocol != nullptr, nullptr ); // bad protocol
   //
-  auto * curl = curl_easy_init();
-  bool   ok   = true;
+  CURL * curl = nullptr;
+  {
+    std::lock_guard lock( m_pool_mutex );
+    //
+    if ( ! m_pool.empty() )
+    {
+      curl = m_pool.back();
+      m_pool.pop_back();
+    }
+  }
+  //
+  if ( curl != nullptr )
+  {
+    m_pool_hits++;
+  }
+  else
+  {
+    m_pool_misses++;
+    curl = curl_easy_init();
+  }
+  //
+  bool ok = true;
   //
   ok = ok && curl != nullptr;
   ok = ok && easy_setopt( curl, CURLOPT_READFUNCTION  , curl_cb_read   );
@@ -171,56 +319,817 @@ CURL * ASync::get_handle( WrapperBase * p_protocol ) const
     return nullptr;
   }
   //
-  return curl;
-}
-
-//--------------------------------------------------------------------
-// Release a handle previously allocated by get_handle, ok on nullptr
-void ASync::return_handle( CURL * & p_curl )
-{
-  curl_easy_cleanup( p_curl ); // ok on nullptr
-  p_curl = nullptr;
+  return curl;
+}
+
+//--------------------------------------------------------------------
+// Release a handle previously allocated by get_handle, ok on nullptr.
+// The handle is kept in the pool if it is not full, after being reset:
+// curl_easy_reset() keeps the cookies, so they are explicitly removed.
+void ASync::return_handle( CURL * & p_curl )
+{
+  if ( p_curl == nullptr )
+    return;
+  //
+  curl_easy_setopt( p_curl, CURLOPT_COOKIELIST, "ALL" );
+  curl_easy_reset ( p_curl );
+  //
+  {
+    std::lock_guard lock( m_pool_mutex );
+    //
+    if ( m_pool.size() < m_pool_size_max )
+    {
+      m_pool.push_back( p_curl );
+      p_curl = nullptr;
+      return;
+    }
+  }
+  //
+  curl_easy_cleanup( p_curl );
+  p_curl = nullptr;
+}
+
+//--------------------------------------------------------------------
+// Enable the pool of easy handles
+void ASync::pool_init()
+{
+  std::lock_guard lock( m_pool_mutex );
+  //
+  m_pool_size_max = c_default_handle_pool_size;
+}
+
+//--------------------------------------------------------------------
+// Release all pooled handles and disable the pool: handles returned
+// later are directly freed.
+void ASync::pool_clear()
+{
+  std::lock_guard lock( m_pool_mutex );
+  //
+  for ( auto * curl : m_pool )
+    curl_easy_cleanup( curl );
+  //
+  m_pool.clear();
+  m_pool_size_max = 0;
+}
+
+//--------------------------------------------------------------------
+// Starts the transfer, ok on nullptr.
+// The handle is queued and will be added to multi by the uv worker thread:
+// the caller never waits for the worker thread.
+bool ASync::start_request( CURL * p_curl, void * p_protocol_cb )
+{
+  if ( ! m_uv_running )
+    return false;
+  //
+  auto * selected = queue_request( p_curl, p_protocol_cb );
+  if ( selected == nullptr )
+    return false;
+  //
+  uv_async_send( &selected->uv_async ); // cannot fail while the loop is running
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Starts several transfers, ok on nullptr.
+// All the requests are queued first, then each loop having received
+// some of them is woken up once.
+// Returns the number of queued requests: on error, the following ones are not started.
+size_t ASync::start_requests( const std::vector< std::pair< CURL *, void * > > & p_requests )
+{
+  if ( ! m_uv_running )
+    return 0;
+  //
+  std::vector< bool > wake_up( m_shards.size(), false );
+  size_t              queued = 0;
+  //
+  for ( const auto & [ curl, protocol_cb ] : p_requests )
+  {
+    auto * selected = queue_request( curl, protocol_cb );
+    if ( selected == nullptr )
+      break;
+    //
+    wake_up[ selected->index ] = true;
+    queued++;
+  }
+  //
+  for ( auto & loop : m_shards )
+    if ( wake_up[ loop->index ] )
+      uv_async_send( &loop->uv_async ); // cannot fail while the loop is running
+  //
+  return queued;
+}
+
+//--------------------------------------------------------------------
+// Assign the request to a shard and queue it, without waking up the loop.
+// Returns the shard, or nullptr on error.
+ASync::shard * ASync::queue_request( CURL * p_curl, void * p_protocol_cb )
+{
+  if ( p_curl == nullptr || p_protocol_cb == nullptr )
+    return nullptr;
+  //
+  if ( ! easy_setopt( p_curl, CURLOPT_PRIVATE, p_protocol_cb ) )
+    return nullptr;
+  //
+  auto & protocol = *static_cast< wrapper_shared_ptr_ptr >( p_protocol_cb );
+  auto & selected = select_shard( protocol->m_origin );
+  //
+  // Remember the shard, used by abort_request, and the queuing time
+  //
+  protocol->m_async_shard = selected.index;
+  protocol->m_queued_ns   = uv_hrtime();
+  protocol->m_queue_us    = 0;
+  //
+  m_nb_running_requests++; // the running state includes the waiting period
+  selected.load++;
+  //
+  if ( selected.uv_commands.push( { command::start, p_curl } ) )
+    return &selected;
+  //
+  curl_easy_setopt( p_curl, CURLOPT_PRIVATE, nullptr );
+  selected.load--;
+  m_nb_running_requests--;
+  return nullptr;
+}
+
+//--------------------------------------------------------------------
+// Aborts a request previously started.
+// The abort is executed by the uv worker thread of the request's shard.
+void ASync::abort_request( WrapperBase * p_protocol, CURL * p_curl )
+{
+  ASSERT_RETURN_VOID( p_protocol != nullptr ); // bad protocol
+  //
+  if ( p_curl != nullptr && p_protocol->m_async_shard < m_shards.size() )
+    send_command( *m_shards[ p_protocol->m_async_shard ], command::abort, p_curl );
+}
+
+//--------------------------------------------------------------------
+// Resumes a request paused by its body receiver.
+// The resume is executed by the uv worker thread of the request's shard.
+void ASync::resume_request( WrapperBase * p_protocol, CURL * p_curl )
+{
+  ASSERT_RETURN_VOID( p_protocol != nullptr ); // bad protocol
+  //
+  if ( p_curl != nullptr && p_protocol->m_async_shard < m_shards.size() )
+    send_command( *m_shards[ p_protocol->m_async_shard ], command::resume, p_curl );
+}
+
+//--------------------------------------------------------------------
+// Prepare the HEAD requests for all the shards, then queue them. The handles
+// are not attached to a wrapper: they are released when the transfer is
+// finished, leaving the connection in the shard's connection cache.
+size_t ASync::prewarm( const std::vector< std::string > & p_urls, unsigned p_connections_per_host )
+{
+  if ( ! m_uv_running )
+    return 0;
+  //
+  auto profile = get_default();
+  //
+  size_t queued = 0;
+  //
+  for ( auto & loop : m_shards )
+  {
+    for ( const auto & url : p_urls )
+    {
+      for ( unsigned connection = 0; connection < p_connections_per_host; connection++ )
+      {
+        CURL * curl = nullptr;
+        bool   ok   = true;
+        //
+        ok = ok && ( curl = curl_easy_init() ) != nullptr;
+        ok = ok && profile->options     .apply( curl );
+        ok = ok && profile->certificates.apply( curl );
+        ok = ok && easy_setopt( curl, CURLOPT_URL     , url.c_str()    );
+        ok = ok && easy_setopt( curl, CURLOPT_NOBODY  , 1L             );
+        ok = ok && easy_setopt( curl, CURLOPT_SHARE   , m_share_handle );
+        ok = ok && easy_setopt( curl, CURLOPT_NOSIGNAL, 1L             );
+        ok = ok && loop->uv_commands.push( { command::prewarm, curl } );
+        //
+        if ( ! ok )
+        {
+          curl_easy_cleanup( curl ); // ok on nullptr
+          break;
+        }
+        //
+        queued++;
+      }
+    }
+    //
+    uv_async_send( &loop->uv_async ); // cannot fail while the loop is running
+  }
+  //
+  return queued;
+}
+
+//--------------------------------------------------------------------
+// Select the least loaded shard.
+// The examination starts from a rotating position, so that shards with
+// the same load are used in turn.
+// The requests to an origin having host limits always use the same shard,
+// whose loop enforces the limits.
+ASync::shard & ASync::select_shard( const std::string & p_origin )
+{
+  auto count = m_shards.size();
+  //
+  if ( ! p_origin.empty() && m_host_limits.count( p_origin ) > 0 )
+    return *m_shards[ std::hash< std::string >{}( p_origin ) % count ];
+  //
+  auto   first    = m_shards_next++ % count;
+  auto * selected = m_shards[ first ].get();
+  //
+  for ( size_t offset = 1; offset < count && selected->load > 0; offset++ )
+  {
+    auto * candidate = m_shards[ ( first + offset ) % count ].get();
+    //
+    if ( candidate->load < selected->load )
+      selected = candidate;
+  }
+  //
+  return *selected;
+}
+
+//--------------------------------------------------------------------
+// Queue a command for the uv worker thread of a shard and wake it up.
+// uv_async_send() coalesces the notifications: several commands may be
+// processed by a single invocation of uv_async_cb().
+bool ASync::send_command( shard & p_shard, command p_command, CURL * p_curl )
+{
+  if ( ! p_shard.uv_commands.push( { p_command, p_curl } ) )
+    return false;
+  //
+  uv_async_send( &p_shard.uv_async ); // cannot fail while the loop is running
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Execute all the queued commands of a shard.
+// Called by the uv worker thread, or when stopping once the thread is terminated:
+// in this case, requests not yet started are aborted.
+void ASync::run_commands( shard & p_shard )
+{
+  p_shard.uv_commands.consume(
+      [ this, &p_shard ]( uv_command && p_command )
+      {
+        auto [ what, curl ] = p_command;
+        //
+        switch ( what )
+        {
+        case command::start:
+          if ( ! throttle_request( p_shard, curl ) )
+            multi_start( p_shard, curl );
+          break;
+        case command::abort:
+          abort_one_request( p_shard, curl );
+          break;
+        case command::abort_all:
+          abort_all_requests( p_shard );
+          break;
+        case command::resume:
+          if ( p_shard.requests_started.count( curl ) > 0 ) // may already be finished
+            curl_easy_pause( curl, CURLPAUSE_CONT );
+          break;
+        case command::prewarm:
+          if ( m_uv_running && multi_attach( p_shard, curl ) && curl_multi_add_handle( p_shard.multi_handle, curl ) == CURLM_OK )
+            p_shard.requests_prewarming.insert( curl );
+          else
+            return_handle( curl );
+          break;
+        case command::configure:
+          multi_configure( p_shard );
+          break;
+        default:
+          break;
+        }
+      } );
+}
+
+//--------------------------------------------------------------------
+// Add a request to multi, or inform the wrapper on failure.
+// A request whose deadline expired while queued is not started.
+// Called by the uv worker thread.
+void ASync::multi_start( shard & p_shard, CURL * p_curl )
+{
+  auto * wrapper = get_wrapper_from_curl( p_curl );
+  long   error   = c_error_internal_start;
+  //
+  if ( ! m_uv_running )
+  {
+    error = CURLE_ABORTED_BY_CALLBACK;
+  }
+  else if ( wrapper != nullptr && *wrapper && ! apply_deadline( p_curl, **wrapper ) )
+  {
+    error = c_error_deadline;
+  }
+  else if ( multi_attach( p_shard, p_curl ) && curl_multi_add_handle( p_shard.multi_handle, p_curl ) == CURLM_OK )
+  {
+    p_shard.requests_started.insert( p_curl );
+    //
+    if ( wrapper != nullptr && *wrapper && ( *wrapper )->m_reattempts > 0 ) // a reattempt released by its host limiter
+      return;
+    //
+    p_shard.metrics.requests_started.add();
+    p_shard.retry_tokens.deposit();
+    //
+    if ( wrapper != nullptr && *wrapper )
+    {
+      ( *wrapper )->m_queue_us = ( uv_hrtime() - ( *wrapper )->m_queued_ns ) / 1'000;
+      hedge_schedule( p_shard, p_curl, **wrapper );
+    }
+    //
+    return;
+  }
+  //
+  if ( wrapper != nullptr && *wrapper )
+    post_to_wrapper( p_shard, p_curl, wrapper, error );
+}
+
+//--------------------------------------------------------------------
+// Shrink the timeout of the next attempt to the time remaining before the
+// deadline of the request. Returns false if the deadline has expired.
+// The timeout is restored by post_to_wrapper.
+// Called by the uv worker thread.
+bool ASync::apply_deadline( CURL * p_curl, WrapperBase & p_wrapper )
+{
+  if ( p_wrapper.m_deadline_ns == 0 )
+    return true;
+  //
+  auto now_ns = uv_hrtime();
+  if ( now_ns >= p_wrapper.m_deadline_ns )
+    return false;
+  //
+  auto remaining_ms = static_cast< long >( std::max< uint64_t >( ( p_wrapper.m_deadline_ns - now_ns ) / 1'000'000, 1 ) );
+  auto timeout_ms   = p_wrapper.get_timeout_ms();
+  //
+  if ( timeout_ms <= 0 || timeout_ms > remaining_ms ) // 0 is no timeout
+    timeout_ms = remaining_ms;
+  //
+  curl_easy_setopt( p_curl, CURLOPT_TIMEOUT_MS, timeout_ms ); // cannot fail
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Host limits, see set_host_limits.
+// A request to a limited origin takes a token and an in-flight slot of
+// its limiter before being added to multi. If none is available, it waits
+// in the limiter until uv_limiter expires or a slot is released.
+// Reattempts release their slot while waiting, then take a token and a
+// slot again: the retries of a request answered by 429 are rate limited.
+// Called by the uv worker thread.
+
+// Return the limiter of the request's origin, nullptr if it has none
+host_limiter * ASync::find_limiter( shard & p_shard, const WrapperBase & p_wrapper )
+{
+  if ( p_shard.limiters.empty() || p_wrapper.m_origin.empty() )
+    return nullptr;
+  //
+  auto found = p_shard.limiters.find( p_wrapper.m_origin );
+  //
+  return found == p_shard.limiters.end() ? nullptr : &found->second;
+}
+
+// Return true if the request must wait: it is then kept by its limiter
+bool ASync::throttle_request( shard & p_shard, CURL * p_curl )
+{
+  auto * wrapper = get_wrapper_from_curl( p_curl );
+  if ( ! m_uv_running || wrapper == nullptr || ! *wrapper )
+    return false;
+  //
+  auto * limiter = find_limiter( p_shard, **wrapper );
+  if ( limiter == nullptr || ( *wrapper )->deadline_expired() ) // expired requests fail in multi_start
+    return false;
+  //
+  auto now = uv_now( p_shard.uv_loop );
+  //
+  if ( limiter->waiting.empty() && limiter->try_acquire( now ) ) // first come, first served
+  {
+    ( *wrapper )->m_host_slot = true;
+    return false;
+  }
+  //
+  limiter->wait( p_curl, static_cast< unsigned >( ( *wrapper )->m_priority ), ( *wrapper )->m_deadline_ns );
+  p_shard.requests_throttled.insert( p_curl );
+  p_shard.metrics.requests_throttled.add();
+  //
+  auto delay_ms = std::min( limiter->wait_ms( now ), deadline_delay_ms( *limiter ) );
+  if ( delay_ms != UINT64_MAX )
+    limiter_wake( p_shard, delay_ms );
+  //
+  return true;
+}
+
+// Remove a terminated request from its limiter, releasing its slot for
+// the next waiting request
+void ASync::leave_limiter( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper )
+{
+  auto * limiter = find_limiter( p_shard, p_wrapper );
+  if ( limiter == nullptr )
+    return;
+  //
+  if ( p_shard.requests_throttled.erase( p_curl ) > 0 )
+    limiter->waiting.erase( std::remove_if( limiter->waiting.begin(), limiter->waiting.end(),
+                                            [ p_curl ]( const auto & waiter ) { return waiter.curl == p_curl; } ),
+                            limiter->waiting.end() );
+  //
+  if ( p_wrapper.m_host_slot )
+  {
+    p_wrapper.m_host_slot = false;
+    limiter->release();
+    limiter_wake( p_shard, 0 ); // not started here, as the caller may be iterating the waiting requests
+  }
+}
+
+// Program uv_limiter to expire in p_delay_ms, unless it expires sooner
+void ASync::limiter_wake( shard & p_shard, uint64_t p_delay_ms )
+{
+  auto due_ms = uv_now( p_shard.uv_loop ) + p_delay_ms;
+  //
+  if ( p_shard.limiter_due_ms != 0 && p_shard.limiter_due_ms <= due_ms )
+    return;
+  //
+  p_shard.limiter_due_ms = due_ms;
+  uv_timer_start( &p_shard.uv_limiter, uv_limiter_cb, p_delay_ms, 0 ); // cannot fail on an initialized timer
+}
+
+// Delay before the first deadline of the waiting requests, UINT64_MAX if none
+uint64_t ASync::deadline_delay_ms( const host_limiter & p_limiter )
+{
+  auto first_ns = UINT64_MAX;
+  //
+  for ( const auto & waiter : p_limiter.waiting )
+    if ( waiter.deadline_ns != 0 )
+      first_ns = std::min( first_ns, waiter.deadline_ns );
+  //
+  if ( first_ns == UINT64_MAX )
+    return UINT64_MAX;
+  //
+  auto now_ns = uv_hrtime();
+  //
+  return first_ns > now_ns ? ( first_ns - now_ns ) / 1'000'000 + 1 : 0;
+}
+
+// Abandon the requests whose deadline expired while waiting, start the
+// waiting requests allowed by their limiter, then program uv_limiter for
+// the next token or deadline
+void ASync::uv_limiter_cb( uv_timer_t * p_handle )
+{
+  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
+  //
+  auto & self = *static_cast< shard * >( p_handle->data );
+  auto   now  = uv_now( self.uv_loop );
+  auto   next = UINT64_MAX;
+  //
+  self.limiter_due_ms = 0;
+  //
+  for ( auto & [ origin, limiter ] : self.limiters )
+  {
+    std::vector< CURL * > expired;
+    //
+    for ( const auto & waiter : limiter.waiting )
+      if ( waiter.deadline_ns != 0 && waiter.deadline_ns <= uv_hrtime() )
+        expired.push_back( waiter.curl );
+    //
+    for ( auto * curl : expired )
+      if ( auto * wrapper = get_wrapper_from_curl( curl ); wrapper != nullptr && *wrapper )
+        self.async.post_to_wrapper( self, curl, wrapper, c_error_deadline ); // removes it from waiting
+    //
+    while ( ! limiter.waiting.empty() && limiter.try_acquire( now ) )
+    {
+      CURL * curl = limiter.waiting.front().curl;
+      limiter.waiting.pop_front();
+      self.requests_throttled.erase( curl );
+      //
+      auto * wrapper = get_wrapper_from_curl( curl );
+      if ( wrapper == nullptr || ! *wrapper ) // not possible
+      {
+        limiter.release();
+        continue;
+      }
+      //
+      ( *wrapper )->m_host_slot = true;
+      self.async.multi_start( self, curl ); // on failure, the slot is released and uv_limiter reprogrammed
+    }
+    //
+    if ( ! limiter.waiting.empty() )
+      next = std::min( { next, limiter.wait_ms( now ), deadline_delay_ms( limiter ) } );
+  }
+  //
+  if ( next != UINT64_MAX )
+    limiter_wake( self, next );
+}
+
+//--------------------------------------------------------------------
+// Hedged requests, see HTTP::hedge.
+// A duplicate is a copy of the easy handle of the primary request, started
+// with its own hedge_receiver. The first response which is not a server
+// error wins: a duplicate winning gives its response and its handle to the
+// primary. A primary failing first waits for its duplicates. The other
+// transfers are aborted when the primary is notified.
+// Called by the uv worker thread.
+
+namespace
+{
+  constexpr uint64_t c_hedge_latency_refresh_ms = 1'000;
+  //
+  // A response received, other than a server error
+  bool hedge_answered( long p_result_code )
+  {
+    return p_result_code >= 100 && p_result_code < 500; // NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+  }
+} // namespace
+
+// Receives the response of a duplicate. It is never notified, and it
+// releases the duplicate handle when deleted.
+class ASync::hedge_receiver : public WrapperBase
+{
+public:
+  hedge_receiver( CURL * p_curl, size_t p_max_response_size, long p_timeout_ms ) :
+    m_curl             ( p_curl              ),
+    m_max_response_size( p_max_response_size ),
+    m_timeout_ms       ( p_timeout_ms        )
+  {
+  }
+  //
+  ~hedge_receiver() override
+  {
+    curl_easy_cleanup( m_curl );
+  }
+  //
+protected:
+  void async_cb( long /*p_result*/ ) override {}
+  //
+  bool use_threaded_cb() const override { return false; }
+  //
+  size_t get_max_response_size() const override { return m_max_response_size; }
+  //
+  const retry_policy & get_retry_policy() const override
+  {
+    static const retry_policy no_retry;
+    return no_retry;
+  }
+  //
+  long get_timeout_ms() const override { return m_timeout_ms; }
+  //
+private:
+  CURL * m_curl;
+  size_t m_max_response_size;
+  long   m_timeout_ms;
+};
+
+// Program the first duplicate of a hedged request added to multi. The
+// requests sending a body or not storing their response are not hedged,
+// nor those hedged after a percentile while no latency was measured.
+void ASync::hedge_schedule( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper )
+{
+  auto & hedge = p_wrapper.m_hedge;
+  //
+  if ( hedge.max_extra == 0 || hedge.started > 0 ||
+       ! p_wrapper.m_request_body.empty() || p_wrapper.m_request_source ||
+       p_wrapper.m_response_receiver      || p_wrapper.m_response_fd >= 0 )
+    return;
+  //
+  auto now = uv_now( p_shard.uv_loop );
+  //
+  hedge.delay_ms = hedge.after_ms;
+  //
+  if ( hedge.percentile > 0 )
+  {
+    if ( p_shard.hedge_latency_ms == 0 || now >= p_shard.hedge_latency_ms + c_hedge_latency_refresh_ms )
+    {
+      p_shard.hedge_latency = {};
+      p_shard.metrics.request_latency_us.add_to( p_shard.hedge_latency );
+      p_shard.hedge_latency_ms = now;
+    }
+    //
+    if ( p_shard.hedge_latency.count == 0 )
+      return;
+    //
+    hedge.delay_ms = p_shard.hedge_latency.percentile( hedge.percentile ) / 1'000;
+  }
+  //
+  hedge.delay_ms = std::max< uint64_t >( hedge.delay_ms, 1 ); // not all at once
+  //
+  hedge.due_ms = now + hedge.delay_ms;
+  p_shard.hedges_due.emplace( hedge.due_ms, p_curl );
+  //
+  hedge_rearm( p_shard );
+}
+
+// Cancel the next duplicate of a request
+void ASync::hedge_unschedule( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper )
+{
+  auto & hedge = p_wrapper.m_hedge;
+  //
+  if ( hedge.due_ms != 0 )
+    p_shard.hedges_due.erase( { hedge.due_ms, p_curl } );
+  //
+  hedge.due_ms = 0;
+}
+
+// Program uv_hedge for the next duplicate
+void ASync::hedge_rearm( shard & p_shard )
+{
+  if ( p_shard.hedges_due.empty() )
+  {
+    uv_timer_stop( &p_shard.uv_hedge );
+    return;
+  }
+  //
+  auto now = uv_now( p_shard.uv_loop );
+  auto due = p_shard.hedges_due.begin()->first;
+  //
+  uv_timer_start( &p_shard.uv_hedge, uv_hedge_cb, due > now ? due - now : 0, 0 ); // cannot fail on an initialized timer
+}
+
+// Start the due duplicates
+void ASync::uv_hedge_cb( uv_timer_t * p_handle )
+{
+  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
+  //
+  auto & self = *static_cast< shard * >( p_handle->data );
+  auto   now  = uv_now( self.uv_loop );
+  //
+  while ( ! self.hedges_due.empty() && self.hedges_due.begin()->first <= now )
+  {
+    CURL * curl = self.hedges_due.begin()->second;
+    self.hedges_due.erase( self.hedges_due.begin() );
+    //
+    if ( auto * wrapper = get_wrapper_from_curl( curl ); wrapper != nullptr && *wrapper )
+    {
+      ( *wrapper )->m_hedge.due_ms = 0;
+      //
+      if ( self.requests_retrying.count( curl ) == 0 ) // not while it waits for its reattempt
+        self.async.hedge_start( self, curl, **wrapper ); // may program the next one
+    }
+  }
+  //
+  hedge_rearm( self );
+}
+
+// Program the next duplicate of a request, then start this one. Like any
+// request, a duplicate must be allowed by the circuit breaker of the origin
+// and take a token and a slot of its host limiter: otherwise it is skipped.
+void ASync::hedge_start( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper )
+{
+  auto & hedge = p_wrapper.m_hedge;
+  auto   now   = uv_now( p_shard.uv_loop );
+  //
+  if ( ++hedge.started < hedge.max_extra )
+  {
+    hedge.due_ms = now + hedge.delay_ms;
+    p_shard.hedges_due.emplace( hedge.due_ms, p_curl );
+  }
+  //
+  if ( ! circuit_allows( p_wrapper.m_origin ) )
+    return;
+  //
+  auto * limiter = find_limiter( p_shard, p_wrapper );
+  if ( limiter != nullptr && ( ! limiter->waiting.empty() || ! limiter->try_acquire( now ) ) ) // never ahead of the waiting requests
+    return;
+  //
+  CURL * curl = curl_easy_duphandle( p_curl );
+  if ( curl == nullptr )
+  {
+    if ( limiter != nullptr )
+      limiter->release();
+    //
+    return;
+  }
+  //
+  auto receiver = std::make_shared< hedge_receiver >( curl, p_wrapper.get_max_response_size(), p_wrapper.get_timeout_ms() ); // owns curl
+  auto * cb_data = new std::shared_ptr< WrapperBase >( receiver );
+  //
+  receiver->m_hedge.primary = p_curl;
+  receiver->m_async_shard   = p_shard.index;
+  receiver->m_queued_ns     = uv_hrtime();
+  receiver->m_origin        = p_wrapper.m_origin;
+  receiver->m_host_slot     = limiter != nullptr;
+  //
+  WrapperBase * data = receiver.get();
+  bool          ok   = true;
+  //
+  ok = ok && easy_setopt( curl, CURLOPT_READDATA  , data    );
+  ok = ok && easy_setopt( curl, CURLOPT_SEEKDATA  , data    );
+  ok = ok && easy_setopt( curl, CURLOPT_WRITEDATA , data    );
+  ok = ok && easy_setopt( curl, CURLOPT_HEADERDATA, data    );
+  ok = ok && easy_setopt( curl, CURLOPT_PRIVATE   , cb_data );
+  ok = ok && multi_attach( p_shard, curl );
+  ok = ok && curl_multi_add_handle( p_shard.multi_handle, curl ) == CURLM_OK;
+  //
+  if ( ! ok )
+  {
+    leave_limiter( p_shard, curl, *receiver );
+    delete cb_data; // releases curl
+    return;
+  }
+  //
+  p_shard.requests_started.insert( curl );
+  p_shard.metrics.requests_hedged.add();
+  p_shard.load++;
+  m_nb_running_requests++;
+  //
+  hedge.running.push_back( curl );
 }
 
-//--------------------------------------------------------------------
-// Starts the transfer, ok on nullptr.
-// Waits the end of the current uv_run() to add the handle.
-bool ASync::start_request( CURL * p_curl, void * p_protocol_cb )
+// Returns true if the completion was handled here: the one of a duplicate,
+// or the failure of a primary whose duplicates are still running.
+bool ASync::hedge_completed( shard & p_shard, CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code )
 {
-  if ( ! easy_setopt( p_curl, CURLOPT_PRIVATE, p_protocol_cb ) )
-    return false;
+  auto & hedge = ( *p_wrapper )->m_hedge;
   //
-  m_nb_running_requests++; // the running state includes the waiting period
+  if ( hedge.primary == nullptr ) // a primary request
+  {
+    if ( hedge_answered( p_result_code ) || hedge.running.empty() )
+      return false; // the duplicates are aborted by post_to_wrapper
+    //
+    hedge_unschedule( p_shard, p_curl, **p_wrapper );
+    hedge.parked      = true;
+    hedge.parked_code = p_result_code;
+    return true;
+  }
+  //
+  CURL * primary_curl = hedge.primary;
+  auto * primary      = get_wrapper_from_curl( primary_curl );
+  //
+  if ( primary == nullptr || ! *primary ) // not possible
+  {
+    post_to_wrapper( p_shard, p_curl, p_wrapper, p_result_code );
+    return true;
+  }
   //
-  m_nb_waiting_requests++;
-  std::lock_guard lock( m_uv_run_mutex );
-  m_nb_waiting_requests--;
+  auto & primary_hedge = ( *primary )->m_hedge;
   //
-  // Added for the next uv_run() (in worker thread of uv_init())
-  if ( curl_multi_add_handle( m_multi_handle, p_curl ) == CURLM_OK ) // ok on nullptr
+  if ( ! hedge_answered( p_result_code ) )
   {
-    m_multi_requests_started.insert( p_curl );
-    m_uv_run_cv.notify_one();
+    post_to_wrapper( p_shard, p_curl, p_wrapper, p_result_code ); // removes it from primary_hedge.running
+    //
+    if ( primary_hedge.parked && primary_hedge.running.empty() ) // all failed, back to the result of the primary
+    {
+      primary_hedge.parked = false;
+      retry_or_post( p_shard, primary_curl, primary, primary_hedge.parked_code );
+    }
+    //
     return true;
   }
   //
+  // The duplicate wins: the primary transfer is stopped and takes its response
+  p_shard.metrics.hedges_won.add();
+  //
+  curl_multi_remove_handle( p_shard.multi_handle, primary_curl ); // ignored if already completed
+  //
+  ( *primary )->m_response_headers = std::move( ( *p_wrapper )->m_response_headers );
+  ( *primary )->m_response_body    = std::move( ( *p_wrapper )->m_response_body    );
+  //
+  auto & running = primary_hedge.running;
+  running.erase( std::remove( running.begin(), running.end(), p_curl ), running.end() );
+  //
+  // The duplicate handle is kept by the primary until its next request
+  leave_limiter( p_shard, p_curl, **p_wrapper );
+  p_shard.requests_started.erase( p_curl );
+  curl_easy_setopt( p_curl, CURLOPT_PRIVATE, nullptr );
+  p_shard.load--;
   m_nb_running_requests--;
-  return false;
+  //
+  primary_hedge.winner      = std::move( *p_wrapper );
+  primary_hedge.winner_curl = p_curl;
+  delete p_wrapper;
+  p_wrapper = nullptr;
+  //
+  if ( p_shard.requests_retrying.erase( primary_curl ) > 0 ) // its reattempt is cancelled, notified once its timer is closed
+  {
+    hedge_abandon( p_shard, primary_curl, **primary );
+    abort_retrying_request( primary, p_result_code );
+  }
+  else
+    post_to_wrapper( p_shard, primary_curl, primary, p_result_code ); // aborts the other duplicates
+  return true;
 }
 
-//--------------------------------------------------------------------
-// Aborts a request previously started
-void ASync::abort_request( CURL * p_curl )
+// Called when a request is notified: a primary aborts its duplicates, a
+// duplicate leaves its primary
+void ASync::hedge_abandon( shard & p_shard, CURL * p_curl, WrapperBase & p_wrapper )
 {
-  m_nb_waiting_requests++;
-  std::lock_guard lock( m_uv_run_mutex );
-  m_nb_waiting_requests--;
+  auto & hedge = p_wrapper.m_hedge;
+  //
+  if ( hedge.primary != nullptr )
+  {
+    if ( auto * primary = get_wrapper_from_curl( hedge.primary ); primary != nullptr && *primary )
+    {
+      auto & running = ( *primary )->m_hedge.running;
+      running.erase( std::remove( running.begin(), running.end(), p_curl ), running.end() );
+    }
+    //
+    return;
+  }
   //
-  // Returns CURLM_OK if the easy handle is removed or was not present (already removed)
-  auto result_code = curl_multi_remove_handle( m_multi_handle, p_curl ); // ok on nullptr
+  hedge_unschedule( p_shard, p_curl, p_wrapper );
   //
-  if ( result_code == CURLM_OK )
-    request_completed( p_curl, CURLE_ABORTED_BY_CALLBACK ); // wrapper cannot be deleted here since it is currently calling us
+  auto running = std::move( hedge.running );
+  hedge.running.clear();
+  hedge.parked = false;
+  //
+  for ( auto * curl : running )
+    abort_one_request( p_shard, curl );
 }
 
 //--------------------------------------------------------------------
@@ -297,6 +1206,7 @@ void ASync::global_clear()
 //--------------------------------------------------------------------
 // Cookies are not shared since the easy handles can be used in
 // different contexts.
+// libcurl does not support sharing connections between concurrent threads.
 bool ASync::share_init()
 {
   m_share_handle = curl_share_init();
@@ -304,7 +1214,6 @@ bool ASync::share_init()
   bool ok = true;
   //
   ok = ok && m_share_handle != nullptr;
-  ok = ok && share_setopt( m_share_handle, CURLSHOPT_SHARE     , CURL_LOCK_DATA_CONNECT     );
   ok = ok && share_setopt( m_share_handle, CURLSHOPT_SHARE     , CURL_LOCK_DATA_DNS         );
   ok = ok && share_setopt( m_share_handle, CURLSHOPT_SHARE     , CURL_LOCK_DATA_SSL_SESSION );
   ok = ok && share_setopt( m_share_handle, CURLSHOPT_LOCKFUNC  , &share_cb_lock             );
@@ -356,43 +1265,78 @@ void ASync::share_cb_lock(
 }
 
 //--------------------------------------------------------------------
-// Keep all the defaults maximum connection limits
-bool ASync::multi_init()
+// The connection limits are set by the default multi options
+bool ASync::multi_init( shard & p_shard )
 {
-  m_multi_handle = curl_multi_init();
+  p_shard.multi_handle = curl_multi_init();
   //
   bool ok = true;
   //
-  ok = ok && m_multi_handle != nullptr;
-  ok = ok && multi_setopt( m_multi_handle, CURLMOPT_SOCKETFUNCTION, &multi_cb_socket );
-  ok = ok && multi_setopt( m_multi_handle, CURLMOPT_TIMERFUNCTION , &multi_cb_timer  );
-  ok = ok && multi_setopt( m_multi_handle, CURLMOPT_SOCKETDATA    , this             );
-  ok = ok && multi_setopt( m_multi_handle, CURLMOPT_TIMERDATA     , this             );
+  ok = ok && p_shard.multi_handle != nullptr;
+  ok = ok && multi_setopt( p_shard.multi_handle, CURLMOPT_SOCKETFUNCTION, &multi_cb_socket );
+  ok = ok && multi_setopt( p_shard.multi_handle, CURLMOPT_TIMERFUNCTION , &multi_cb_timer  );
+  ok = ok && multi_setopt( p_shard.multi_handle, CURLMOPT_SOCKETDATA    , &p_shard         );
+  ok = ok && multi_setopt( p_shard.multi_handle, CURLMOPT_TIMERDATA     , &p_shard         );
+  ok = ok && multi_configure( p_shard );
   //
   if ( ! ok )
   {
-    curl_multi_cleanup( m_multi_handle ); // ok on nullptr
-    m_multi_handle = nullptr;
+    curl_multi_cleanup( p_shard.multi_handle ); // ok on nullptr
+    p_shard.multi_handle = nullptr;
   }
   //
   return ok;
 }
 
 //--------------------------------------------------------------------
-void ASync::multi_clear()
+void ASync::multi_clear( shard & p_shard )
+{
+  curl_multi_cleanup( p_shard.multi_handle ); // ok on nullptr
+  p_shard.multi_handle = nullptr;
+}
+
+//--------------------------------------------------------------------
+// Apply the default multi options to the shard's multi handle.
+// Called by the uv worker thread, or by start() before it is started.
+bool ASync::multi_configure( shard & p_shard )
+{
+  MultiOptions options;
+  {
+    std::shared_lock lock( p_shard.async.m_default_locks );
+    //
+    options = p_shard.async.m_default_multi_options;
+  }
+  //
+  return options.apply( p_shard.multi_handle );
+}
+
+//--------------------------------------------------------------------
+// Set the socket functions of an easy handle before adding it to the
+// shard's multi handle, to count the connections it opens.
+// Connections keep the close function of the handle that opened them.
+// Called by the uv worker thread.
+bool ASync::multi_attach( shard & p_shard, CURL * p_curl )
 {
-  curl_multi_cleanup( m_multi_handle ); // ok on nullptr
-  m_multi_handle = nullptr;
+  bool ok = true;
+  //
+  ok = ok && easy_setopt( p_curl, CURLOPT_OPENSOCKETFUNCTION , curl_cb_open_socket  );
+  ok = ok && easy_setopt( p_curl, CURLOPT_OPENSOCKETDATA     , &p_shard             );
+  ok = ok && easy_setopt( p_curl, CURLOPT_CLOSESOCKETFUNCTION, curl_cb_close_socket );
+  ok = ok && easy_setopt( p_curl, CURLOPT_CLOSESOCKETDATA    , &p_shard             );
+  //
+  return ok;
 }
 
 //--------------------------------------------------------------------
 // Abort all pending requests before ASync resources are destroyed.
 
-// Abort one request waiting to reattempt
-void ASync::abort_retrying_request( wrapper_shared_ptr_ptr & p_wrapper ) // NOLINT( readability-function-cognitive-complexity )
+// Abort one request waiting to reattempt, it is notified with p_result_code
+void ASync::abort_retrying_request( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code ) // NOLINT( readability-function-cognitive-complexity )
 {
   auto & retry_timer = ( *p_wrapper )->m_retry_uv_timer;
   //
+  ( *p_wrapper )->m_retry_abort_code = p_result_code;
+  //
   uv_timer_stop( &retry_timer );
   //
   if ( uv_is_closing( reinterpret_cast< uv_handle_t * >( &retry_timer ) ) == 0 ) // NOLINT( cppcoreguidelines-pro-type-reinterpret-cast )
@@ -406,58 +1350,72 @@ void ASync::abort_retrying_request( wrapper_shared_ptr_ptr & p_wrapper ) // NOLI
                               handle->loop       != nullptr &&
                               handle->loop->data != nullptr ); // not possible
           //
-          auto * closed_curl    = static_cast< CURL *  >( handle->data );
-          auto * self           = static_cast< ASync * >( handle->loop->data );
+          auto * closed_curl    = static_cast< CURL *         >( handle->data );
+          auto * closed_shard   = static_cast< ASync::shard * >( handle->loop->data );
           auto * closed_wrapper = ASync::get_wrapper_from_curl( closed_curl );
           //
           ASSERT_RETURN_VOID( closed_wrapper != nullptr && *closed_wrapper ); // not possible, since it was there above, post_to_wrapper must have already be called
           //
-          self->post_to_wrapper( closed_curl, closed_wrapper, CURLE_ABORTED_BY_CALLBACK );
+          closed_shard->async.post_to_wrapper( *closed_shard, closed_curl, closed_wrapper, ( *closed_wrapper )->m_retry_abort_code );
         } );
   }
 }
 
 // Abort one request
-// Similar to abort_request
-void ASync::abort_started_request( wrapper_shared_ptr_ptr & p_wrapper, CURL * p_curl )
+void ASync::abort_started_request( shard & p_shard, wrapper_shared_ptr_ptr & p_wrapper, CURL * p_curl )
 {
-  curl_multi_remove_handle( m_multi_handle, p_curl );
+  curl_multi_remove_handle( p_shard.multi_handle, p_curl );
   //
-  post_to_wrapper( p_curl, p_wrapper, CURLE_ABORTED_BY_CALLBACK );
+  post_to_wrapper( p_shard, p_curl, p_wrapper, CURLE_ABORTED_BY_CALLBACK );
 }
 
-// Loop on all requests
-void ASync::abort_pending_requests()
+// Abort one request, running, waiting in a host limiter or waiting to reattempt.
+// Ignored if the request is already terminated.
+// Called by the uv worker thread.
+void ASync::abort_one_request( shard & p_shard, CURL * p_curl )
 {
-  {
-    std::lock_guard lock( m_uv_run_mutex );
-    //
-    std::vector< CURL * > requests;
-    requests.assign( m_multi_requests_started.begin(), m_multi_requests_started.end() );
-    //
-    for ( auto * curl : requests )
-    {
-      auto * wrapper = get_wrapper_from_curl( curl );
-      if ( wrapper == nullptr || ! *wrapper )            // not possible
-        continue;
-      //
-      if ( m_multi_requests_retrying.erase( curl ) > 0 ) // it was waiting to retry
-        abort_retrying_request( wrapper );               // modifies m_multi_requests_started
-      else
-        abort_started_request( wrapper, curl );          // modifies m_multi_requests_started
-    }
-    //
-    multi_update_running_stats( 0 );
-  }
+  bool throttled = p_shard.requests_throttled.count( p_curl ) > 0;
   //
-  m_uv_run_cv.notify_one();
-  m_cb_cv.notify_one();
+  if ( ! throttled && p_shard.requests_started.count( p_curl ) == 0 ) // already terminated
+    return;
+  //
+  auto * wrapper = get_wrapper_from_curl( p_curl );
+  if ( wrapper == nullptr || ! *wrapper )              // not possible
+    return;
+  //
+  if ( throttled )                                     // never added to multi
+    post_to_wrapper( p_shard, p_curl, wrapper, CURLE_ABORTED_BY_CALLBACK ); // modifies requests_throttled
+  else if ( p_shard.requests_retrying.erase( p_curl ) > 0 ) // it was waiting to retry
+    abort_retrying_request( wrapper );                 // modifies requests_started
+  else
+    abort_started_request( p_shard, wrapper, p_curl ); // modifies requests_started
+}
+
+// Loop on all requests of a shard.
+// Called by the uv worker thread.
+void ASync::abort_all_requests( shard & p_shard )
+{
+  std::vector< CURL * > requests;
+  requests.assign( p_shard.requests_started  .begin(), p_shard.requests_started  .end() );
+  requests.insert( requests.end(), p_shard.requests_throttled.begin(), p_shard.requests_throttled.end() );
+  //
+  for ( auto * curl : requests )
+    abort_one_request( p_shard, curl );
+  //
+  multi_update_running_stats( p_shard, 0 );
+}
+
+// Ask the uv worker threads to abort all requests
+void ASync::abort_pending_requests()
+{
+  for ( auto & loop : m_shards )
+    send_command( *loop, command::abort_all, nullptr );
 }
 
 //--------------------------------------------------------------------
 // Check if some multi operation are completed.
 // Remove them and notify the wrapper.
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 namespace
 {
   // Find the result to send to the wrapper: the libcurl error code if transfer failed,
@@ -482,44 +1440,64 @@ namespace
   }
 } // namespace
 
-void ASync::multi_fetch_messages()
+void ASync::multi_fetch_messages( shard & p_shard )
 {
   CURLMsg * message = nullptr;
   int       pending = 0;
   //
-  while ( ( message = curl_multi_info_read( m_multi_handle, &pending ) ) != nullptr )
+  while ( ( message = curl_multi_info_read( p_shard.multi_handle, &pending ) ) != nullptr )
   {
     if ( message->msg == CURLMSG_DONE )
     {
-      curl_multi_remove_handle( m_multi_handle, message->easy_handle );
+      curl_multi_remove_handle( p_shard.multi_handle, message->easy_handle );
+      //
+      if ( CURL * curl = message->easy_handle; p_shard.requests_prewarming.erase( curl ) > 0 )
+      {
+        return_handle( curl ); // the connection stays in the multi connection cache
+        continue;
+      }
       //
       request_completed(
+          p_shard,
           message->easy_handle,
           outcome_code( message ) ); // wrapper can be deleted here, easy_handle may be invalid
     }
   }
 }
 
+//--------------------------------------------------------------------
+// Release the prewarm() handles still running when stopping
+void ASync::multi_clear_prewarming( shard & p_shard )
+{
+  for ( CURL * curl : p_shard.requests_prewarming )
+  {
+    curl_multi_remove_handle( p_shard.multi_handle, curl );
+    curl_easy_cleanup( curl );
+  }
+  //
+  p_shard.requests_prewarming.clear();
+}
+
 //--------------------------------------------------------------------
 // Called by curl_multi_socket_action(), curl_multi_add_handle()... to start and stop timers.
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 int ASync::multi_cb_timer(
     CURLM * /* multi */,
     long    p_timeout_ms,
     void *  p_clientp )
 {
   bool   ok   = true;
-  auto * self = static_cast< ASync * >( p_clientp );
+  auto * self = static_cast< shard * >( p_clientp );
   //
   ok = ok && self != nullptr; // always true
   //
   if ( p_timeout_ms < 0 ) // delete the timer
   {
-    ok = ok && uv_timer_stop( &self->m_uv_timer ) == 0;
+    ok = ok && uv_timer_stop( &self->uv_timer ) == 0;
   }
   else // add or replace a timer
   {
-    ok = ok && uv_timer_start( &self->m_uv_timer,
+    ok = ok && uv_timer_start( &self->uv_timer,
                                uv_timeout_cb,
                                static_cast< uint64_t >( p_timeout_ms ),
                                0 ) == 0;
@@ -531,7 +1509,7 @@ int ASync::multi_cb_timer(
 //--------------------------------------------------------------------
 // Called by curl_multi_socket_action when there is an update on one of multi socket.
 // Either we expect data (and call uv_poll_start) or are done (and call uv_poll_stop).
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 int ASync::multi_cb_socket(
     CURL *        /* easy */,
     curl_socket_t p_socket,
@@ -541,7 +1519,7 @@ int ASync::multi_cb_socket(
 {
   ASSERT_RETURN( p_user_data != nullptr, -1 ); // not possible
   //
-  auto * self    = static_cast< ASync *        >( p_user_data   ); // CURLMOPT_SOCKETDATA
+  auto * self    = static_cast< shard *        >( p_user_data   ); // CURLMOPT_SOCKETDATA
   auto * context = static_cast< curl_context * >( p_socket_data ); // curl_multi_assign
   //
   bool ok     = true;
@@ -553,7 +1531,7 @@ int ASync::multi_cb_socket(
   case CURL_POLL_OUT:
   case CURL_POLL_INOUT:
     if ( context == nullptr ) // the first time, create the context
-      context = self->create_curl_context( p_socket );
+      context = create_curl_context( *self, p_socket );
     //
     if ( p_what != CURL_POLL_IN )
       events |= UV_WRITABLE;
@@ -561,13 +1539,13 @@ int ASync::multi_cb_socket(
       events |= UV_READABLE;
     //
     ok = ok && context != nullptr;
-    ok = ok && curl_multi_assign( self->m_multi_handle, p_socket, context ) == CURLM_OK;
+    ok = ok && curl_multi_assign( self->multi_handle, p_socket, context ) == CURLM_OK;
     ok = ok && uv_poll_start( &context->poll, events, &uv_io_cb ) == 0;
     break;
   case CURL_POLL_REMOVE:
     ok = ok && context != nullptr;
     ok = ok && uv_poll_stop( &context->poll ) == 0;
-    ok = ok && curl_multi_assign( self->m_multi_handle, p_socket, nullptr ) == CURLM_OK; // clear the context reference
+    ok = ok && curl_multi_assign( self->multi_handle, p_socket, nullptr ) == CURLM_OK; // clear the context reference
     //
     destroy_curl_context( context ); // ok on nullptr
     break;
@@ -579,65 +1557,81 @@ int ASync::multi_cb_socket(
 }
 
 //--------------------------------------------------------------------
-// Start UV loop and timer, and the worker thread waiting for IO
-bool ASync::uv_init()
+// Start the UV loop, timer and async of a shard, and the worker thread waiting for IO
+bool ASync::uv_init( shard & p_shard )
 {
   bool ok = true;
   //
-  ok = ok && m_uv_loop == nullptr; // already started
-  ok = ok && ( m_uv_loop = new ( std::nothrow ) uv_loop_t ) != nullptr;
-  ok = ok && 0 == uv_loop_init ( m_uv_loop );
-  ok = ok && 0 == uv_timer_init( m_uv_loop, &m_uv_timer );
+  ok = ok && p_shard.uv_loop == nullptr; // already started
+  ok = ok && ( p_shard.uv_loop = new ( std::nothrow ) uv_loop_t ) != nullptr;
+  ok = ok && 0 == uv_loop_init     ( p_shard.uv_loop );
+  ok = ok && 0 == uv_loop_configure( p_shard.uv_loop, UV_METRICS_IDLE_TIME ); // for uv_prepare_cb
+  ok = ok && 0 == uv_timer_init    ( p_shard.uv_loop, &p_shard.uv_timer );
+  ok = ok && 0 == uv_timer_init    ( p_shard.uv_loop, &p_shard.uv_limiter );
+  ok = ok && 0 == uv_timer_init    ( p_shard.uv_loop, &p_shard.uv_hedge );
+  ok = ok && 0 == uv_async_init    ( p_shard.uv_loop, &p_shard.uv_async, uv_async_cb );
+  ok = ok && 0 == uv_prepare_init  ( p_shard.uv_loop, &p_shard.uv_prepare );
+  ok = ok && 0 == uv_prepare_start ( &p_shard.uv_prepare, uv_prepare_cb );
   //
   if ( ok )
   {
-    m_uv_loop->data = this;
-    m_uv_timer.data = this;
-    m_uv_running    = true;
-    m_uv_worker     = std::thread(
-        [ this ]
+    uv_unref( reinterpret_cast< uv_handle_t * >( &p_shard.uv_prepare ) ); // does not keep the loop alive
+    //
+    p_shard.uv_loop->data   = &p_shard;
+    p_shard.uv_timer.data   = &p_shard;
+    p_shard.uv_limiter.data = &p_shard;
+    p_shard.uv_hedge.data   = &p_shard;
+    p_shard.uv_async.data   = &p_shard;
+    p_shard.uv_prepare.data = &p_shard;
+    p_shard.uv_worker     = std::thread(
+        [ &p_shard ]
         {
-          std::unique_lock lock( m_uv_run_mutex );
-          //
-          while ( m_uv_running )
-            if ( uv_run( m_uv_loop, UV_RUN_NOWAIT ) == 0 ) // if no requests are executing:
-              uv_run_wait_requests( lock );                //   wait for new ones (unlock, wait, lock)
-            else                                           // else
-              uv_run_accept_requests( lock );              //   accept new ones (unlock, accept, lock)
+          // The async handle keeps the loop alive, until uv_stop() is called by uv_async_cb()
+          uv_run( p_shard.uv_loop, UV_RUN_DEFAULT );
         } );
   }
   else
   {
-    uv_clear_loop( m_uv_loop ); // ok on nullptr
+    uv_clear_loop( p_shard.uv_loop ); // ok on nullptr
   }
   //
   return ok;
 }
 
 //--------------------------------------------------------------------
-void ASync::uv_clear()
+void ASync::uv_clear( shard & p_shard )
 {
-  m_uv_running = false;
-  m_uv_run_cv.notify_one(); // speedup the exit of uv_run_wait_requests
+  // uv_async is set to the shard in start(): it is used to know if uv_async_init was called
+  if ( p_shard.uv_async.data != nullptr )
+    uv_async_send( &p_shard.uv_async ); // uv_async_cb() will stop the loop since m_uv_running is false
+  //
+  if ( p_shard.uv_worker.joinable() )
+    p_shard.uv_worker.join();
+  //
+  // Abort commands queued during the stop
+  if ( p_shard.uv_async.data != nullptr )
+  {
+    run_commands( p_shard );
+    p_shard.uv_async.data = nullptr;
+  }
   //
-  if ( m_uv_worker.joinable() )
-    m_uv_worker.join();
+  multi_clear_prewarming( p_shard );
   //
-  // m_uv_timer is set to this in start(): it is used to know if uv_timer_init was called
-  if ( m_uv_timer.data != nullptr )
+  // uv_timer is set to the shard in start(): it is used to know if uv_timer_init was called
+  if ( p_shard.uv_timer.data != nullptr )
   {
-    uv_timer_stop( &m_uv_timer ); // crashes if uv_timer_init was not called
-    m_uv_timer.data = nullptr;
+    uv_timer_stop( &p_shard.uv_timer ); // crashes if uv_timer_init was not called
+    p_shard.uv_timer.data = nullptr;
   }
   //
-  if ( m_uv_loop != nullptr )
+  if ( p_shard.uv_loop != nullptr )
   {
     // see https://stackoverflow.com/questions/25615340/closing-libuv-handles-correctly
     //
-    uv_stop( m_uv_loop );
+    uv_stop( p_shard.uv_loop );
     //
     uv_walk(
-        m_uv_loop,
+        p_shard.uv_loop,
         []( uv_handle_t * handle, void * /* argument */ )
         {
           if ( uv_is_closing( handle ) == 0 )
@@ -645,54 +1639,76 @@ void ASync::uv_clear()
         },
         nullptr );
     //
-    while ( uv_run( m_uv_loop, UV_RUN_ONCE ) != 0 )
+    while ( uv_run( p_shard.uv_loop, UV_RUN_ONCE ) != 0 )
       uv_sleep( c_short_wait_ms );
     //
-    uv_clear_loop( m_uv_loop );
+    uv_clear_loop( p_shard.uv_loop );
   }
 }
 
 //--------------------------------------------------------------------
-// Called between uv_run by uv_init thread when there is requests executing.
-// Try to sleep as little as possible, not at all if possible.
-// unlock, accept start_request/abort_request, lock
-void ASync::uv_run_accept_requests( std::unique_lock< std::mutex > & p_lock ) const
+// Called by uv_run() when start_request(), abort_request()... have queued
+// some commands, or when stopping.
+// Called by the uv worker thread.
+void ASync::uv_async_cb( uv_async_t * p_handle )
 {
-  if ( m_nb_waiting_requests == 0 ) // then it is not even needed to unlock
-    return;
+  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
   //
-  p_lock.unlock();
+  auto * self = static_cast< shard * >( p_handle->data );
   //
-  uv_sleep( m_nb_waiting_requests / c_requests_per_ms );
+  self->async.run_commands( *self );
   //
-  p_lock.lock();
+  if ( ! self->async.m_uv_running ) // stop() was called
+    uv_stop( self->uv_loop );
 }
 
 //--------------------------------------------------------------------
-// Called between uv_run by uv_init thread when there is no request executing.
-// unlock, wait for start_request, lock
-void ASync::uv_run_wait_requests( std::unique_lock< std::mutex > & p_lock ) const
+// Called by uv_run() before waiting for IO, once per loop iteration.
+// The time spent processing events since the previous call is the time elapsed
+// minus the time the loop spent waiting.
+// Called by the uv worker thread.
+void ASync::uv_prepare_cb( uv_prepare_t * p_handle )
 {
-  m_uv_run_cv.wait_for( p_lock, c_event_wait_timeout );
+  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
+  //
+  auto * self    = static_cast< shard * >( p_handle->data );
+  auto   now_ns  = uv_hrtime();
+  auto   idle_ns = uv_metrics_idle_time( self->uv_loop );
+  //
+  if ( self->last_prepare_ns != 0 )
+  {
+    auto elapsed_ns = now_ns  - self->last_prepare_ns;
+    auto waited_ns  = idle_ns - self->last_idle_ns;
+    //
+    self->metrics.loop_busy_us.record( elapsed_ns > waited_ns ? ( elapsed_ns - waited_ns ) / 1'000 : 0 );
+  }
+  //
+  self->metrics.loop_iterations.add();
+  self->last_prepare_ns = now_ns;
+  self->last_idle_ns    = idle_ns;
 }
 
 //--------------------------------------------------------------------
-// m_uv_run_mutex must be locked.
-void ASync::multi_update_running_stats( int p_running_handles )
+// Called by the uv worker thread.
+// The statistics are aggregated over all the shards.
+void ASync::multi_update_running_stats( shard & p_shard, int p_running_handles )
 {
+  auto delta   = p_running_handles - p_shard.running_handles;
+  auto current = m_multi_running_current.fetch_add( delta ) + delta;
+  //
+  p_shard.running_handles = p_running_handles;
+  //
   int previous = m_multi_running_max.load();
   //
-  while ( p_running_handles > previous &&
-          ! m_multi_running_max.compare_exchange_strong( previous, p_running_handles ) )
+  while ( current > previous &&
+          ! m_multi_running_max.compare_exchange_strong( previous, current ) )
     ;
-  //
-  m_multi_running_current = p_running_handles;
 }
 
 //--------------------------------------------------------------------
 // Called by uv_run() when there is some data sent/received, inform multi,
 // then check if the multi operation are finished.
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 void ASync::uv_io_cb(
   uv_poll_t * p_handle,
   int         /* status */,
@@ -701,168 +1717,432 @@ void ASync::uv_io_cb(
   ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
   //
   auto * context = static_cast< curl_context * >( p_handle->data );
+  auto & owner   = context->owner;
   //
-  uv_timer_stop( &context->async.m_uv_timer );
-  //
+  // The timer is not stopped here: libcurl only calls multi_cb_timer when its
+  // timeout changes, and the transfer timeouts would then never expire
   int flags = 0;
   if ( ( p_events & UV_READABLE ) != 0 ) flags |= CURL_CSELECT_IN;
   if ( ( p_events & UV_WRITABLE ) != 0 ) flags |= CURL_CSELECT_OUT;
   //
   int running_handles = 0;
-  curl_multi_socket_action( context->async.m_multi_handle, context->curl, flags, &running_handles ); // call multi_cb_socket
+  curl_multi_socket_action( owner.multi_handle, context->curl, flags, &running_handles ); // call multi_cb_socket
+  //
+  owner.async.multi_update_running_stats( owner, running_handles );
+  //
+  owner.async.multi_fetch_messages( owner ); // must be the last line as the wrapper can be deleted here
+}
+
+//--------------------------------------------------------------------
+// Called by uv_run() when a timeout is triggered.
+// The timer used is the one in the shard.
+// Called by the uv worker thread.
+void ASync::uv_timeout_cb( uv_timer_t * p_handle )
+{
+  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
+  //
+  auto * self = static_cast< shard * >( p_handle->data );
+  //
+  // Inform multi that a timeout occurred
+  int running_handles = 0;
+  curl_multi_socket_action( self->multi_handle, CURL_SOCKET_TIMEOUT, 0, &running_handles ); // call multi_cb_socket
+  //
+  self->async.multi_update_running_stats( *self, running_handles );
+  //
+  self->async.multi_fetch_messages( *self ); // must be the last line as the wrapper can be deleted here
+}
+
+//--------------------------------------------------------------------
+// Called by uv_run() when a request is programmed to restart by request_completed().
+// The timer used is the one in WrapperBase.
+// Called by the uv worker thread.
+void ASync::uv_restart_cb( uv_timer_t * p_handle ) // NOLINT( readability-function-cognitive-complexity )
+{
+  ASSERT_RETURN_VOID( p_handle != nullptr ); // not possible
+  //
+  uv_close(
+      reinterpret_cast< uv_handle_t * >( p_handle ), // NOLINT( cppcoreguidelines-pro-type-reinterpret-cast )
+      []( uv_handle_t * handle )
+      {
+        ASSERT_RETURN_VOID( handle             != nullptr &&
+                            handle->data       != nullptr &&
+                            handle->loop       != nullptr &&
+                            handle->loop->data != nullptr ); // not possible
+        //
+        auto * curl = static_cast< CURL *         >( handle->data       );
+        auto * self = static_cast< ASync::shard * >( handle->loop->data );
+        //
+        self->requests_retrying.erase( curl );
+        //
+        auto * wrapper = ASync::get_wrapper_from_curl( curl );
+        if ( wrapper == nullptr )
+          return;
+        //
+        ASSERT_RETURN_VOID( *wrapper ); // not possible
+        //
+        // Re-post the request, unless it waits for its host limiter or its deadline has expired
+        if ( self->async.throttle_request( *self, curl ) )
+          return;
+        //
+        long error = c_error_deadline;
+        //
+        if ( ASync::apply_deadline( curl, **wrapper ) )
+        {
+          if ( curl_multi_add_handle( self->multi_handle, curl ) == CURLM_OK ) // ok on nullptr
+            return;
+          //
+          error = c_error_internal_restart;
+        }
+        //
+        // On error, inform the Wrapper
+        self->async.post_to_wrapper( *self, curl, wrapper, error );
+      } );
+}
+
+//--------------------------------------------------------------------
+// The context is shared between multi and UV:
+//  - as multi socket data (curl_multi_assign)
+//  - in UV poll member data (here)
+// Called by the uv worker thread.
+ASync::curl_context * ASync::create_curl_context( shard & p_shard, curl_socket_t p_socket )
+{
+  auto * context = new ( std::nothrow ) curl_context( p_shard, p_socket );
+  if ( context == nullptr )
+    return nullptr;
+  //
+  if ( uv_poll_init_socket( p_shard.uv_loop, &context->poll, p_socket ) == 0 )
+  {
+    context->poll.data = context;
+  }
+  else
+  {
+    delete context;
+    context = nullptr;
+  }
+  //
+  return context;
+}
+
+//--------------------------------------------------------------------
+// Delete a context created by create_curl_context.
+// Ok on nullptr.
+// Called by the uv worker thread.
+void ASync::destroy_curl_context( curl_context * p_context )
+{
+  if ( p_context != nullptr )
+  {
+    // From doc: uv_handle_t is the base type for all handles...any libuv handle can be cast to uv_handle_t
+    uv_close(
+        reinterpret_cast< uv_handle_t * >( &p_context->poll ), // NOLINT( cppcoreguidelines-pro-type-reinterpret-cast )
+        []( uv_handle_t * handle )
+        {
+          ASSERT_RETURN_VOID( handle != nullptr && handle->data != nullptr ); // not possible
+          //
+          auto * context = static_cast< curl_context * >( handle->data );
+          delete context;
+        } );
+  }
+}
+
+//--------------------------------------------------------------------
+// Start the CB worker threads that will call the Wrapper callback.
+// There is no thread if a custom executor is used.
+bool ASync::cb_init( unsigned p_threads )
+{
+  m_cb_running = true;
+  //
+  if ( m_cb_executor )
+    return true;
+  //
+  for ( unsigned index = 0; index < std::max( p_threads, 1U ); index++ )
+    m_cb_threads.emplace_back( [ this ] { cb_run(); } );
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Stop the CB worker threads
+void ASync::cb_clear()
+{
+  {
+    std::lock_guard lock( m_cb_mutex );
+    m_cb_running = false;
+  }
+  m_cb_cv.notify_all(); // speedup the exit of cb_run
+  //
+  for ( auto & thread : m_cb_threads )
+    if ( thread.joinable() )
+      thread.join();
+  //
+  m_cb_threads.clear();
+  //
+  for ( auto & queue : m_cb_queues )
+    queue.clear();
+  //
+  m_cb_pending = 0;
+}
+
+//--------------------------------------------------------------------
+// Set the custom executor used instead of the CB worker threads
+bool ASync::set_callback_executor( callback_executor p_executor )
+{
+  if ( m_uv_running )
+    return false;
+  //
+  m_cb_executor = std::move( p_executor );
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Set the retry budget used by the shards created by start()
+bool ASync::set_retry_budget( double p_ratio, double p_min_per_second, double p_capacity )
+{
+  if ( m_uv_running || p_ratio < 0 || p_min_per_second < 0 || p_capacity < 1 )
+    return false;
+  //
+  m_retry_budget_ratio      = p_ratio;
+  m_retry_budget_per_second = p_min_per_second;
+  m_retry_budget_capacity   = p_capacity;
+  //
+  return true;
+}
+
+//--------------------------------------------------------------------
+// Enable the circuit breakers
+bool ASync::set_circuit_breaker( unsigned p_failures, unsigned p_open_ms )
+{
+  if ( m_uv_running || p_failures == 0 )
+    return false;
   //
-  context->async.multi_update_running_stats( running_handles );
+  m_circuits.configure( p_failures, p_open_ms );
   //
-  context->async.multi_fetch_messages(); // must be the last line as the wrapper can be deleted here
+  return true;
 }
 
 //--------------------------------------------------------------------
-// Called by uv_run() when a timeout is triggered.
-// The timer used is the one in ASync.
-// m_uv_run_mutex is locked.
-void ASync::uv_timeout_cb( uv_timer_t * p_handle )
+// Set the limits of an origin
+bool ASync::set_host_limits( const std::string & p_url, const host_limits & p_limits )
 {
-  ASSERT_RETURN_VOID( p_handle != nullptr && p_handle->data != nullptr ); // not possible
-  //
-  auto * self = static_cast< ASync * >( p_handle->data );
+  auto origin = url_origin( p_url );
   //
-  // Inform multi that a timeout occurred
-  int running_handles = 0;
-  curl_multi_socket_action( self->m_multi_handle, CURL_SOCKET_TIMEOUT, 0, &running_handles ); // call multi_cb_socket
+  if ( m_uv_running || origin.empty() || p_limits.requests_per_second < 0 || p_limits.burst < 0 )
+    return false;
   //
-  self->multi_update_running_stats( running_handles );
+  m_host_limits[ origin ] = p_limits;
   //
-  self->multi_fetch_messages(); // must be the last line as the wrapper can be deleted here
+  return true;
 }
 
 //--------------------------------------------------------------------
-// Called by uv_run() when a request is programmed to restart by request_completed().
-// The timer used is the one in WrapperBase.
-// m_uv_run_mutex is locked.
-void ASync::uv_restart_cb( uv_timer_t * p_handle ) // NOLINT( readability-function-cognitive-complexity )
+// Check the circuit breaker of the origin before preparing a request.
+// Called by the Wrapper, in the user's thread.
+bool ASync::circuit_allows( const std::string & p_origin )
 {
-  ASSERT_RETURN_VOID( p_handle != nullptr ); // not possible
+  if ( ! m_circuits.enabled() || p_origin.empty() )
+    return true;
   //
-  uv_close(
-      reinterpret_cast< uv_handle_t * >( p_handle ), // NOLINT( cppcoreguidelines-pro-type-reinterpret-cast )
-      []( uv_handle_t * handle )
-      {
-        ASSERT_RETURN_VOID( handle             != nullptr &&
-                            handle->data       != nullptr &&
-                            handle->loop       != nullptr &&
-                            handle->loop->data != nullptr ); // not possible
-        //
-        auto * curl = static_cast< CURL *  >( handle->data       );
-        auto * self = static_cast< ASync * >( handle->loop->data );
-        //
-        self->m_multi_requests_retrying.erase( curl );
-        //
-        if ( ASync::get_wrapper_from_curl( curl ) == nullptr )
-          return;
-        //
-        // Re-post the request
-        if ( curl_multi_add_handle( self->m_multi_handle, curl ) == CURLM_OK ) // ok on nullptr
-          return;
-        //
-        // On error, inform the Wrapper
-        auto * wrapper = ASync::get_wrapper_from_curl( curl );
-        //
-        ASSERT_RETURN_VOID( wrapper != nullptr && *wrapper ); // not possible
-        //
-        self->post_to_wrapper( curl, wrapper, c_error_internal_restart );
-      } );
+  if ( m_circuits.allow( p_origin, uv_hrtime() / 1'000'000 ) )
+    return true;
+  //
+  m_circuit_rejected++;
+  return false;
 }
 
 //--------------------------------------------------------------------
-// The context is shared between multi and UV:
-//  - as multi socket data (curl_multi_assign)
-//  - in UV poll member data (here)
-// m_uv_run_mutex is locked.
-ASync::curl_context * ASync::create_curl_context( curl_socket_t p_socket )
+std::map< std::string, circuit_state > ASync::circuits() const
 {
-  auto * context = new ( std::nothrow ) curl_context( *this, p_socket );
-  if ( context == nullptr )
-    return nullptr;
+  return m_circuits.states( uv_hrtime() / 1'000'000 );
+}
+
+//--------------------------------------------------------------------
+// Queue a job for the CB worker threads, or pass it to the custom executor.
+// If the custom executor fails, the Wrapper is called immediately.
+void ASync::cb_push( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code )
+{
+  if ( m_cb_executor )
+  {
+    m_cb_pending++;
+    //
+    try
+    {
+      m_cb_executor(
+          [ this, wrapper = p_wrapper, p_result_code, queued_ns = uv_hrtime() ]() mutable
+          {
+            m_cb_pending--;
+            cb_invoke( wrapper, p_result_code, queued_ns );
+          } );
+    }
+    catch ( ... )
+    {
+      m_cb_pending--;
+      invoke_wrapper( p_wrapper, p_result_code );
+    }
+    //
+    return;
+  }
   //
-  if ( uv_poll_init_socket( m_uv_loop, &context->poll, p_socket ) == 0 )
+  auto rank = static_cast< size_t >( ( *p_wrapper )->m_priority );
   {
-    context->poll.data = context;
+    std::lock_guard lock( m_cb_mutex );
+    m_cb_queues[ rank ].emplace_back( p_wrapper, p_result_code, uv_hrtime() );
+    m_cb_pending++;
   }
-  else
+  m_cb_cv.notify_one();
+}
+
+//--------------------------------------------------------------------
+// Retrieve the first job of the highest priority.
+// Called with m_cb_mutex locked.
+bool ASync::cb_pop( cb_job & p_job )
+{
+  for ( auto & queue : m_cb_queues )
   {
-    delete context;
-    context = nullptr;
+    if ( ! queue.empty() )
+    {
+      p_job = queue.front();
+      queue.pop_front();
+      m_cb_pending--;
+      return true;
+    }
   }
   //
-  return context;
+  return false;
 }
 
 //--------------------------------------------------------------------
-// Delete a context created by create_curl_context.
-// Ok on nullptr.
-// m_uv_run_mutex is locked.
-void ASync::destroy_curl_context( curl_context * p_context )
+// The loop of a CB worker thread
+namespace
 {
-  if ( p_context != nullptr )
+  void update_maximum( std::atomic_uint64_t & p_maximum, uint64_t p_value )
   {
-    // From doc: uv_handle_t is the base type for all handles...any libuv handle can be cast to uv_handle_t
-    uv_close(
-        reinterpret_cast< uv_handle_t * >( &p_context->poll ), // NOLINT( cppcoreguidelines-pro-type-reinterpret-cast )
-        []( uv_handle_t * handle )
-        {
-          ASSERT_RETURN_VOID( handle != nullptr && handle->data != nullptr ); // not possible
-          //
-          auto * context = static_cast< curl_context * >( handle->data );
-          delete context;
-        } );
+    auto previous = p_maximum.load();
+    //
+    while ( p_value > previous &&
+            ! p_maximum.compare_exchange_weak( previous, p_value ) )
+      ;
+  }
+} // namespace
+
+void ASync::cb_run()
+{
+  cb_job           job;
+  std::unique_lock lock( m_cb_mutex );
+  //
+  while ( m_cb_running )
+  {
+    if ( cb_pop( job ) )
+    {
+      lock.unlock();
+      //
+      auto [ wrapper, result_code, queued_ns ] = job;
+      cb_invoke( wrapper, result_code, queued_ns );
+      //
+      lock.lock();
+    }
+    else
+    {
+      m_cb_cv.wait_for( lock, c_event_wait_timeout ); // unlock, wait, lock
+    }
   }
 }
 
 //--------------------------------------------------------------------
-// Start the CB worker thread that will call the Wrapper callback
-bool ASync::cb_init()
+// Call the wrapper from a CB worker thread or the custom executor, and update the statistics
+void ASync::cb_invoke( wrapper_shared_ptr_ptr & p_wrapper, long p_result_code, uint64_t p_queued_ns )
 {
-  m_cb_running = true;
-  m_cb_worker  = std::thread(
-      [ this ]
-      {
-        std::unique_lock lock( m_cb_mutex );              // lock
-        //
-        while ( m_cb_running )
-        {
-          while ( ! m_cb_queue.empty() )                  // if some notifications are pending
-          {
-            auto [ wrapper, p_result_code ] = m_cb_queue.front();
-            m_cb_queue.pop_front();
-            lock.unlock();                                // retrieve the notification, unlock
-            //
-            invoke_wrapper( wrapper, p_result_code );
-            //
-            lock.lock();                                  // lock
-          }
-          //
-          m_cb_cv.wait_for( lock, c_event_wait_timeout ); // unlock, wait, lock
-        }
-      } );
+  auto started_ns = uv_hrtime();
   //
-  return true;
+  invoke_wrapper( p_wrapper, p_result_code );
+  //
+  auto wait_ns = started_ns  - p_queued_ns;
+  auto run_ns  = uv_hrtime() - started_ns;
+  //
+  m_cb_invoked++;
+  m_cb_wait_ns += wait_ns;
+  m_cb_run_ns  += run_ns;
+  update_maximum( m_cb_wait_ns_max, wait_ns );
+  update_maximum( m_cb_run_ns_max , run_ns  );
 }
 
 //--------------------------------------------------------------------
-// Stop the CB worker thread
-void ASync::cb_clear()
+// Retrieve the statistics of the CB worker threads
+ASync::callback_stats ASync::callback_statistics() const
 {
-  m_cb_running = false;
-  m_cb_cv.notify_one(); // speedup the exit of cb_init's thread
+  constexpr uint64_t ns_per_us = 1'000;
+  //
+  callback_stats stats;
+  //
+  stats.threads     = static_cast< unsigned >( m_cb_threads.size() );
+  stats.queued      = m_cb_pending;
+  stats.invoked     = m_cb_invoked;
+  stats.wait_max_us = m_cb_wait_ns_max / ns_per_us;
+  stats.run_max_us  = m_cb_run_ns_max  / ns_per_us;
+  //
+  if ( stats.invoked > 0 )
+  {
+    stats.wait_avg_us = m_cb_wait_ns / stats.invoked / ns_per_us;
+    stats.run_avg_us  = m_cb_run_ns  / stats.invoked / ns_per_us;
+  }
+  //
+  return stats;
+}
+
+//--------------------------------------------------------------------
+// Aggregate the metrics of all the shards.
+// Each value is read atomically, but they are not read at the same instant.
+metrics_snapshot ASync::metrics() const
+{
+  metrics_snapshot snapshot;
+  //
+  snapshot.requests_active   = m_nb_running_requests;
+  snapshot.requests_peak     = m_multi_running_max;
+  snapshot.callbacks_queued  = m_cb_pending;
+  snapshot.callbacks_invoked = m_cb_invoked;
+  snapshot.protocol_crashed  = m_protocol_has_crashed;
+  snapshot.circuit_rejected  = m_circuit_rejected;
+  //
+  for ( const auto & [ origin, state ] : circuits() )
+    if ( state != circuit_state::closed )
+      snapshot.circuits_open++;
+  //
+  {
+    std::shared_lock lock( m_default_locks );
+    //
+    snapshot.connections_limit = m_default_multi_options.max_total_connections() * static_cast< long >( m_shards.size() );
+  }
   //
-  if ( m_cb_worker.joinable() )
-    m_cb_worker.join();
+  for ( const auto & loop : m_shards )
+  {
+    const auto & metrics = loop->metrics;
+    //
+    snapshot.requests_started      += metrics.requests_started     .load();
+    snapshot.requests_completed    += metrics.requests_completed   .load();
+    snapshot.requests_retried      += metrics.requests_retried     .load();
+    snapshot.requests_retry_denied += metrics.requests_retry_denied.load();
+    snapshot.requests_throttled    += metrics.requests_throttled   .load();
+    snapshot.requests_hedged       += metrics.requests_hedged      .load();
+    snapshot.hedges_won            += metrics.hedges_won           .load();
+    snapshot.loop_iterations       += metrics.loop_iterations      .load();
+    snapshot.connections_opened    += metrics.connections_opened   .load();
+    snapshot.connections_closed    += metrics.connections_closed   .load();
+    //
+    for ( size_t index = 0; index < metrics.results.size(); index++ )
+      if ( auto count = metrics.results[ index ].load(); count > 0 )
+        snapshot.results[ static_cast< long >( index ) + loop_metrics::c_result_min ] += count;
+    //
+    metrics.request_latency_us.add_to( snapshot.request_latency_us );
+    metrics.loop_busy_us      .add_to( snapshot.loop_busy_us       );
+  }
+  //
+  return snapshot;
 }
 
 //--------------------------------------------------------------------
 // To read data to send during a transfer.
-// Data is located in the Protocol and is a std::string.
-// m_uv_run_mutex is locked.
+// Data is located in the Protocol and is a std::string, or is read from
+// the Protocol's body source if set.
+// Called by the uv worker thread.
 size_t ASync::curl_cb_read( void * p_ptr, size_t p_size, size_t p_nmemb, void * p_userdata )
 {
   ASSERT_RETURN( p_userdata != nullptr, CURL_READFUNC_ABORT );
@@ -872,6 +2152,23 @@ size_t ASync::curl_cb_read( void * p_ptr, size_t p_size, size_t p_nmemb, void *
   if ( __builtin_mul_overflow( p_size, p_nmemb, &size ) )
     return CURL_READFUNC_ABORT;
   //
+  if ( protocol->m_request_source != nullptr )
+  {
+    size_t read = 0;
+    //
+    try
+    {
+      if ( ! protocol->m_request_source->read( static_cast< char * >( p_ptr ), size, read ) || read > size )
+        return CURL_READFUNC_ABORT;
+    }
+    catch ( ... )
+    {
+      return CURL_READFUNC_ABORT;
+    }
+    //
+    return read; // 0 ends the transfer
+  }
+  //
   ASSERT_RETURN( protocol->m_request_body.size() > protocol->m_request_body_sent, CURL_READFUNC_ABORT );
   //
   auto to_read = std::min(
@@ -897,6 +2194,21 @@ int ASync::curl_cb_seek( void * p_clientp, curl_off_t p_offset, int p_origin )
   //
   auto * protocol = static_cast< WrapperBase * >( p_clientp );
   //
+  if ( protocol->m_request_source != nullptr )
+  {
+    try
+    {
+      if ( p_offset >= 0 && protocol->m_request_source->seek( p_offset ) )
+        return CURL_SEEKFUNC_OK;
+    }
+    catch ( ... )
+    {
+      return CURL_SEEKFUNC_FAIL;
+    }
+    //
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  //
   if ( p_offset < 0 || static_cast< size_t >( p_offset ) >= protocol->m_request_body.size() )
     return CURL_SEEKFUNC_CANTSEEK;
   //
@@ -907,8 +2219,9 @@ int ASync::curl_cb_seek( void * p_clientp, curl_off_t p_offset, int p_origin )
 
 //--------------------------------------------------------------------
 // To store data received during the transfer.
-// Data is located in the Protocol and is a std::string.
-// m_uv_run_mutex is locked.
+// Data is located in the Protocol and is a std::string, or is passed
+// to the Protocol's body receiver or written to its file descriptor if set.
+// Called by the uv worker thread.
 size_t ASync::curl_cb_write( const char * p_ptr, size_t p_size, size_t p_nmemb, void * p_userdata )
 {
   ASSERT_RETURN( p_userdata != nullptr, CURL_WRITEFUNC_ERROR );
@@ -925,10 +2238,67 @@ size_t ASync::curl_cb_write( const char * p_ptr, size_t p_size, size_t p_nmemb,
     if ( protocol->m_header_content_length > protocol->get_max_response_size() )
       return CURL_WRITEFUNC_ERROR;
     //
-    protocol->m_response_body.reserve( protocol->m_header_content_length );
+    if ( protocol->m_response_fd >= 0 )
+    {
+      #ifdef FALLOC_FL_KEEP_SIZE
+        // Preallocate without changing the file size (in case of failure), not supported by all file systems
+        if ( protocol->m_response_fd_start >= 0 )
+          static_cast< void >( fallocate( protocol->m_response_fd, FALLOC_FL_KEEP_SIZE,
+                                          protocol->m_response_fd_start + static_cast< off_t >( protocol->m_response_received ),
+                                          static_cast< off_t >( protocol->m_header_content_length ) ) );
+      #endif
+    }
+    else if ( protocol->m_response_receiver == nullptr )
+    {
+      protocol->m_response_body.reserve( protocol->m_header_content_length );
+    }
+    //
     protocol->m_header_content_length = 0;
   }
   //
+  // Streaming: the size limit applies to the total received size
+  if ( protocol->m_response_receiver != nullptr )
+  {
+    if ( protocol->m_response_received + size > protocol->get_max_response_size() )
+      return CURL_WRITEFUNC_ERROR;
+    //
+    try
+    {
+      if ( ! protocol->m_response_receiver( std::string_view( p_ptr, size ) ) )
+        return CURL_WRITEFUNC_PAUSE; // libcurl will pass the same data again once resumed
+    }
+    catch ( ... )
+    {
+      return CURL_WRITEFUNC_ERROR;
+    }
+    //
+    protocol->m_response_received += size;
+    //
+    return size;
+  }
+  //
+  // Writing to a file: the size limit applies to the total received size
+  if ( protocol->m_response_fd >= 0 )
+  {
+    if ( protocol->m_response_received + size > protocol->get_max_response_size() )
+      return CURL_WRITEFUNC_ERROR;
+    //
+    for ( size_t written = 0; written < size; )
+    {
+      auto result = write( protocol->m_response_fd, p_ptr + written, size - written );
+      //
+      if ( result == 0 || ( result < 0 && errno != EINTR ) ) // EAGAIN included: the descriptor must be blocking
+        return CURL_WRITEFUNC_ERROR;
+      //
+      if ( result > 0 )
+        written += static_cast< size_t >( result );
+    }
+    //
+    protocol->m_response_received += size;
+    //
+    return size;
+  }
+  //
   // Prevent exceeding max response size
   if ( protocol->m_response_body.size() + size > protocol->get_max_response_size() )
     return CURL_WRITEFUNC_ERROR;
@@ -948,7 +2318,7 @@ size_t ASync::curl_cb_write( const char * p_ptr, size_t p_size, size_t p_nmemb,
 //--------------------------------------------------------------------
 // To store header received during the transfer.
 // Data is located in the Protocol and is a std::map< std::string, std::string >.
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 size_t ASync::curl_cb_header( const char * p_buffer, size_t p_size, size_t p_nitems, void * p_userdata )
 {
   ASSERT_RETURN( p_userdata != nullptr, CURL_WRITEFUNC_ERROR );
@@ -978,6 +2348,36 @@ size_t ASync::curl_cb_header( const char * p_buffer, size_t p_size, size_t p_nit
   return p_nitems * p_size;
 }
 
+//--------------------------------------------------------------------
+// Open a socket for libcurl, as it does by default, and count it.
+// Called by the uv worker thread.
+curl_socket_t ASync::curl_cb_open_socket( void * p_clientp, curlsocktype /* p_purpose */, curl_sockaddr * p_address )
+{
+  ASSERT_RETURN( p_clientp != nullptr && p_address != nullptr, CURL_SOCKET_BAD );
+  //
+  auto * self = static_cast< shard * >( p_clientp );
+  auto   fd   = socket( p_address->family, p_address->socktype, p_address->protocol );
+  //
+  if ( fd != CURL_SOCKET_BAD )
+    self->metrics.connections_opened.add();
+  //
+  return fd;
+}
+
+//--------------------------------------------------------------------
+// Close a socket opened by curl_cb_open_socket.
+// Called by the uv worker thread, or when stopping once it is terminated.
+int ASync::curl_cb_close_socket( void * p_clientp, curl_socket_t p_socket )
+{
+  ASSERT_RETURN( p_clientp != nullptr, 1 );
+  //
+  auto * self = static_cast< shard * >( p_clientp );
+  //
+  self->metrics.connections_closed.add();
+  //
+  return close( p_socket );
+}
+
 //--------------------------------------------------------------------
 // Wait for all pending requests to finish.
 // Wait the maximum given tame, returns false if timeout is reached
@@ -997,76 +2397,155 @@ bool ASync::wait_pending_requests( unsigned p_timeout_ms ) const
 //--------------------------------------------------------------------
 // Handles the termination of the request. If configured, the request
 // may be restarted.
-// m_uv_run_mutex is locked.
-namespace
-{
-  // Check if the code guarantees that the request can be resubmitted without side effect
-  bool safe_to_restart_outcome( long p_result_code )
-  {
-    return p_result_code == CURLE_COULDNT_RESOLVE_HOST
-        || p_result_code == CURLE_COULDNT_RESOLVE_PROXY
-        || p_result_code == CURLE_COULDNT_CONNECT
-        || p_result_code == CURLE_SSL_CONNECT_ERROR
-        || p_result_code == CURLE_PEER_FAILED_VERIFICATION
-        || p_result_code == 429 // Too Many Requests    NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
-        || p_result_code == 503 // Service Unavailable  NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
-        ;
-  }
-} // namespace
-
-void ASync::request_completed( CURL * p_curl, long p_result_code )
+// Called by the uv worker thread.
+void ASync::request_completed( shard & p_shard, CURL * p_curl, long p_result_code )
 {
   auto * wrapper = get_wrapper_from_curl( p_curl );
   if ( wrapper == nullptr || ! *wrapper )
     return;
   //
-  // Check the maximum number or reattempts and the result code
-  if ( ( *wrapper )->can_reattempt() && safe_to_restart_outcome( p_result_code ) )
+  if ( m_circuits.enabled() && ! ( *wrapper )->m_origin.empty() )
+    m_circuits.record( ( *wrapper )->m_origin, p_result_code, uv_hrtime() / 1'000'000 );
+  //
+  if ( hedge_completed( p_shard, p_curl, wrapper, p_result_code ) )
+    return;
+  //
+  retry_or_post( p_shard, p_curl, wrapper, p_result_code );
+}
+
+// Restart the request if the retry policy allows it, else inform the wrapper
+void ASync::retry_or_post( shard & p_shard, CURL * p_curl, wrapper_shared_ptr_ptr & p_wrapper, long p_result_code )
+{
+  // Check the retry policy, the result code and the retry budget
+  if ( uint64_t delay_ms = 0; retry_delay( p_shard, **p_wrapper, p_result_code, delay_ms ) )
   {
+    if ( ! ( *p_wrapper )->reset_response() ) // discard a partially received response
+    {
+      post_to_wrapper( p_shard, p_curl, p_wrapper, c_error_response_file_set );
+      return;
+    }
+    //
     bool ok = true;
     //
-    ok = ok && 0 == uv_timer_init ( m_uv_loop, &( *wrapper )->m_retry_uv_timer );
-    ok = ok && 0 == uv_timer_start( &( *wrapper )->m_retry_uv_timer, uv_restart_cb,
-                                    ( *wrapper )->get_retry_delay_ms(), 0 );
+    ok = ok && 0 == uv_timer_init ( p_shard.uv_loop, &( *p_wrapper )->m_retry_uv_timer );
+    ok = ok && 0 == uv_timer_start( &( *p_wrapper )->m_retry_uv_timer, uv_restart_cb, delay_ms, 0 );
     //
     if ( ok )
     {
-      m_multi_requests_retrying.insert( p_curl );
+      p_shard.requests_retrying.insert( p_curl );
+      p_shard.metrics.requests_retried.add();
+      leave_limiter   ( p_shard, p_curl, **p_wrapper ); // the reattempt waits for a new slot and token
+      hedge_unschedule( p_shard, p_curl, **p_wrapper ); // and is not duplicated
       return;
     }
     //
     // Keep the original result code if the restart fails
   }
   //
-  post_to_wrapper( p_curl, wrapper, p_result_code );
+  post_to_wrapper( p_shard, p_curl, p_wrapper, p_result_code );
+}
+
+//--------------------------------------------------------------------
+// Decide if a failed request is reattempted, and after which delay.
+// The Retry-After header is read before the response is discarded.
+// Called by the uv worker thread.
+bool ASync::retry_delay( shard & p_shard, WrapperBase & p_wrapper, long p_result_code, uint64_t & p_delay_ms )
+{
+  const auto & policy = p_wrapper.get_retry_policy();
+  //
+  if ( p_wrapper.m_reattempts >= policy.max_retries )
+    return false;
+  //
+  if ( ! p_wrapper.response_rewindable() ) // the data already delivered cannot be taken back
+    return false;
+  //
+  try
+  {
+    if ( ! ( policy.retryable ? policy.retryable( p_result_code ) : retry_policy::default_retryable( p_result_code ) ) )
+      return false;
+  }
+  catch ( ... )
+  {
+    return false; // keep the original result code
+  }
+  //
+  std::uniform_real_distribution< double > random( 0.0, 1.0 );
+  //
+  p_delay_ms = policy.delay_ms( p_wrapper.m_reattempts + 1, random( p_shard.retry_random ) );
+  //
+  if ( policy.honor_retry_after )
+  {
+    const auto & headers = p_wrapper.m_response_headers;
+    //
+    if ( auto found = headers.find( "Retry-After" ); found != headers.end() )
+    {
+      uint64_t wait_ms = 0;
+      //
+      if ( parse_retry_after( found->second, static_cast< int64_t >( time( nullptr ) ), wait_ms ) )
+      {
+        if ( wait_ms > policy.max_delay_ms ) // the server asks to wait longer than accepted
+          return false;
+        //
+        p_delay_ms = std::max( p_delay_ms, wait_ms );
+      }
+    }
+  }
+  //
+  // The reattempt would not start before the deadline
+  if ( p_wrapper.m_deadline_ns != 0 && uv_hrtime() + p_delay_ms * 1'000'000 >= p_wrapper.m_deadline_ns )
+    return false;
+  //
+  // The body is sent again from its beginning
+  if ( ! p_wrapper.rewind_request() )
+    return false;
+  //
+  if ( p_shard.retry_tokens.enabled() && ! p_shard.retry_tokens.withdraw( uv_now( p_shard.uv_loop ) ) )
+  {
+    p_shard.metrics.requests_retry_denied.add();
+    return false;
+  }
+  //
+  p_wrapper.m_reattempts++;
+  return true;
 }
 
 //--------------------------------------------------------------------
 // Returns the operation outcome to the wrapper, depending on the config:
-//  1] push the job in the queue, callback thread will call the Wrapper.
+//  1] push the job in a queue, callback threads will call the Wrapper.
 //  2] call the Wrapper from UV worker thread.
-// m_uv_run_mutex is locked.
+// Called by the uv worker thread.
 void ASync::post_to_wrapper(
+    shard &                  p_shard,
     CURL *                   p_curl,
     wrapper_shared_ptr_ptr & p_wrapper,
     long                     p_result_code )
 {
   ASSERT_RETURN_VOID( p_curl != nullptr ); // not possible
   //
-  m_multi_requests_started .erase( p_curl );
-  m_multi_requests_retrying.erase( p_curl );
+  p_shard.requests_started .erase( p_curl );
+  p_shard.requests_retrying.erase( p_curl );
   //
   curl_easy_setopt( p_curl, CURLOPT_PRIVATE, nullptr ); // set when Wrapper start(), cleared here
   //
   ASSERT_RETURN_VOID( p_wrapper != nullptr && *p_wrapper ); // not possible
   //
-  if ( ( *p_wrapper )->use_threaded_cb() ) // push it to CB queue for later delivery
+  leave_limiter( p_shard, p_curl, **p_wrapper );
+  hedge_abandon( p_shard, p_curl, **p_wrapper );
+  //
+  // Restore the timeout shrunk by apply_deadline, the handle being reused by the next request
+  if ( ( *p_wrapper )->m_deadline_ns != 0 )
+    curl_easy_setopt( p_curl, CURLOPT_TIMEOUT_MS, ( *p_wrapper )->get_timeout_ms() );
+  //
+  if ( ( *p_wrapper )->m_hedge.primary == nullptr ) // the duplicates of hedged requests are not counted
   {
-    {
-      std::lock_guard lock( m_cb_mutex );
-      m_cb_queue.emplace_back( p_wrapper, p_result_code );
-    }
-    m_cb_cv.notify_one();
+    p_shard.metrics.requests_completed.add();
+    p_shard.metrics.record_result( p_result_code );
+    p_shard.metrics.request_latency_us.record( ( uv_hrtime() - ( *p_wrapper )->m_queued_ns ) / 1'000 );
+  }
+  //
+  if ( ( *p_wrapper )->use_threaded_cb() && ( m_cb_executor || ! m_cb_threads.empty() ) ) // push it to CB queue for later delivery
+  {
+    cb_push( p_wrapper, p_result_code );
   }
   else // call it now and here (in uv_run worker thread)
   {
@@ -1076,13 +2555,16 @@ void ASync::post_to_wrapper(
 
 //--------------------------------------------------------------------
 // Call the wrapper, delete the shared_ptr.
-// m_uv_run_mutex may be locked.
+// Called by the uv worker thread or the callback thread.
 void ASync::invoke_wrapper(
   wrapper_shared_ptr_ptr & p_wrapper,
   long                     p_result_code )
 {
   ASSERT_RETURN_VOID( p_wrapper != nullptr && *p_wrapper );
   //
+  // Retrieved before the Wrapper is released and possibly restarted
+  auto shard_index = ( *p_wrapper )->m_async_shard;
+  //
   try
   {
     ( *p_wrapper )->async_cb( p_result_code ); // call Protocol
@@ -1092,6 +2574,9 @@ void ASync::invoke_wrapper(
     m_protocol_has_crashed = true;
   }
   //
+  if ( shard_index < m_shards.size() )
+    m_shards[ shard_index ]->load--;
+  //
   m_nb_running_requests--;
   //
   ( *p_wrapper ).reset(); // possibly delete Protocol
@@ -0,0 +1,104 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <curl/curl.h>
+
+#include "circuit_breaker.hpp"
+
+namespace curlev
+{
+
+namespace
+{
+  // Lower result codes are libcurl or curlev errors
+  constexpr long c_first_response_code = 100;
+} // namespace
+
+//--------------------------------------------------------------------
+void circuit_breakers::configure( unsigned p_failures, unsigned p_open_ms ) noexcept
+{
+  m_failures_max = p_failures;
+  m_open_ms      = p_open_ms;
+}
+
+//--------------------------------------------------------------------
+// When the open delay has elapsed, the caller becomes the probe, and the
+// next probe is delayed in case this one never completes.
+bool circuit_breakers::allow( const std::string & p_origin, uint64_t p_now_ms )
+{
+  std::lock_guard lock( m_mutex );
+  //
+  auto found = m_breakers.find( p_origin );
+  if ( found == m_breakers.end() || ! found->second.open )
+    return true;
+  //
+  if ( p_now_ms < found->second.probe_ms )
+    return false;
+  //
+  found->second.probe_ms = p_now_ms + m_open_ms;
+  return true;
+}
+
+//--------------------------------------------------------------------
+// A response closes the circuit and forgets the origin. A failure while
+// open (a failed probe) postpones the next probe. Other errors, such as
+// an abort, tell nothing about the origin.
+void circuit_breakers::record( const std::string & p_origin, long p_result_code, uint64_t p_now_ms )
+{
+  std::lock_guard lock( m_mutex );
+  //
+  if ( ! is_failure( p_result_code ) )
+  {
+    if ( p_result_code == CURLE_OK || p_result_code >= c_first_response_code )
+      m_breakers.erase( p_origin );
+    //
+    return;
+  }
+  //
+  auto & state = m_breakers[ p_origin ];
+  //
+  if ( state.open )
+  {
+    state.probe_ms = p_now_ms + m_open_ms;
+  }
+  else if ( ++state.failures >= m_failures_max )
+  {
+    state.open     = true;
+    state.probe_ms = p_now_ms + m_open_ms;
+  }
+}
+
+//--------------------------------------------------------------------
+std::map< std::string, circuit_state > circuit_breakers::states( uint64_t p_now_ms ) const
+{
+  std::map< std::string, circuit_state > states;
+  //
+  std::lock_guard lock( m_mutex );
+  //
+  for ( const auto & [ origin, state ] : m_breakers )
+    states[ origin ] = ! state.open                ? circuit_state::closed :
+                       p_now_ms < state.probe_ms   ? circuit_state::open   :
+                                                     circuit_state::half_open;
+  //
+  return states;
+}
+
+//--------------------------------------------------------------------
+bool circuit_breakers::is_failure( long p_result_code )
+{
+  return p_result_code == CURLE_COULDNT_RESOLVE_HOST
+      || p_result_code == CURLE_COULDNT_CONNECT
+      || p_result_code == CURLE_OPERATION_TIMEDOUT
+      || p_result_code == CURLE_SSL_CONNECT_ERROR
+      || p_result_code == CURLE_SEND_ERROR
+      || p_result_code == CURLE_RECV_ERROR
+      || p_result_code == CURLE_GOT_NOTHING
+      || p_result_code == 502 // Bad Gateway          NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      || p_result_code == 503 // Service Unavailable  NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      || p_result_code == 504 // Gateway Timeout      NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      ;
+}
+
+} // namespace curlev
@@ -0,0 +1,97 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "host_limiter.hpp"
+
+namespace curlev
+{
+
+namespace
+{
+  constexpr double c_ms_per_second = 1'000.0;
+} // namespace
+
+//--------------------------------------------------------------------
+// The bucket starts full
+host_limiter::host_limiter( const host_limits & p_limits ) :
+  m_limits( p_limits )
+{
+  if ( m_limits.burst <= 0 )
+    m_limits.burst = std::max( m_limits.requests_per_second, 1.0 );
+  //
+  m_tokens = m_limits.burst;
+}
+
+//--------------------------------------------------------------------
+void host_limiter::refill( uint64_t p_now_ms ) noexcept
+{
+  if ( m_last_ms != 0 && p_now_ms > m_last_ms )
+  {
+    auto elapsed = static_cast< double >( p_now_ms - m_last_ms ) / c_ms_per_second;
+    m_tokens     = std::min( m_tokens + elapsed * m_limits.requests_per_second, m_limits.burst );
+  }
+  //
+  m_last_ms = p_now_ms;
+}
+
+//--------------------------------------------------------------------
+bool host_limiter::try_acquire( uint64_t p_now_ms ) noexcept
+{
+  if ( m_limits.max_in_flight > 0 && m_in_flight >= m_limits.max_in_flight )
+    return false;
+  //
+  if ( m_limits.requests_per_second > 0 )
+  {
+    refill( p_now_ms );
+    //
+    if ( m_tokens < 1.0 )
+      return false;
+    //
+    m_tokens -= 1.0;
+  }
+  //
+  m_in_flight++;
+  return true;
+}
+
+//--------------------------------------------------------------------
+void host_limiter::release() noexcept
+{
+  if ( m_in_flight > 0 )
+    m_in_flight--;
+}
+
+//--------------------------------------------------------------------
+// After the requests of the same or a lower rank
+void host_limiter::wait( CURL * p_curl, unsigned p_rank, uint64_t p_deadline_ns )
+{
+  auto position = std::upper_bound(
+      waiting.begin(), waiting.end(), p_rank,
+      []( unsigned rank, const waiter & other ) { return rank < other.rank; } );
+  //
+  waiting.insert( position, { p_curl, p_rank, p_deadline_ns } );
+}
+
+//--------------------------------------------------------------------
+uint64_t host_limiter::wait_ms( uint64_t p_now_ms ) noexcept
+{
+  if ( m_limits.max_in_flight > 0 && m_in_flight >= m_limits.max_in_flight )
+    return UINT64_MAX;
+  //
+  if ( m_limits.requests_per_second <= 0 )
+    return 0;
+  //
+  refill( p_now_ms );
+  //
+  if ( m_tokens >= 1.0 )
+    return 0;
+  //
+  return static_cast< uint64_t >( std::ceil( ( 1.0 - m_tokens ) / m_limits.requests_per_second * c_ms_per_second ) );
+}
+
+} // namespace curlev
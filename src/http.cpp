@@ -3,9 +3,14 @@
  * SPDX-License-Identifier: Apache-2.0
  ********************************************************************/
 
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+
 #include "http.hpp"
 #include "utils/assert_return.hpp"
 #include "utils/curl_utils.hpp"
+#include "utils/mapped_file.hpp"
 
 namespace curlev
 {
@@ -36,6 +41,9 @@ HTTP & HTTP::REQUEST( const std::string & p_method, std::string p_url, const key
       //
       if ( ! ok && m_response_code == c_success )
         m_response_code = c_error_url_set;
+      //
+      set_url_origin( p_url );
+      m_idempotent = p_method == "GET" || p_method == "HEAD";
   } );
   //
   return *this;
@@ -64,7 +72,7 @@ HTTP & HTTP::add_headers( const key_values & p_headers )
 HTTP & HTTP::set_body( const std::string & p_content_type, std::string && p_body )
 {
   do_if_idle( [ & ]() {
-    ASSERT_RETURN_VOID( m_curl_mime == nullptr && request_body().empty() ); // avoid setting body twice
+    ASSERT_RETURN_VOID( m_curl_mime == nullptr && request_body().empty() && request_source() == nullptr ); // avoid setting body twice
     //
     set_request_body( std::move( p_body ) );
     //
@@ -80,6 +88,84 @@ HTTP & HTTP::set_body( const std::string & p_content_type, std::string && p_body
   return *this;
 }
 
+//--------------------------------------------------------------------
+// Set a body read from a source during the transfer
+HTTP & HTTP::set_body( const std::string & p_content_type, std::unique_ptr< body_source > && p_source )
+{
+  do_if_idle( [ & ]() {
+    ASSERT_RETURN_VOID( m_curl_mime == nullptr && request_body().empty() && request_source() == nullptr ); // avoid setting body twice
+    //
+    bool ok = p_source != nullptr;
+    //
+    set_request_source( std::move( p_source ) );
+    //
+    ok = ok && curl_header_checked_append( m_curl_headers, "Content-Type", p_content_type );
+    ok = ok && prepare_request_body(); // ASync will read from m_request_source
+    //
+    if ( ! ok && m_response_code == c_success )
+      m_response_code = c_error_body_set;
+  } );
+  //
+  return *this;
+}
+
+//--------------------------------------------------------------------
+namespace
+{
+  // A body source reading from a memory mapped file
+  class mapped_file_source : public body_source
+  {
+  public:
+    explicit mapped_file_source( std::unique_ptr< mapped_file > && p_file ) : m_file( std::move( p_file ) ) {}
+    //
+    int64_t size() const override
+    {
+      return static_cast< int64_t >( m_file->size() );
+    }
+    //
+    bool read( char * p_buffer, size_t p_size, size_t & p_read ) override
+    {
+      p_read = std::min( p_size, m_file->size() - m_sent );
+      //
+      if ( p_read > 0 )
+        memcpy( p_buffer, m_file->data() + m_sent, p_read ); /* flawfinder: ignore */
+      //
+      m_sent += p_read;
+      return true;
+    }
+    //
+    bool seek( int64_t p_offset ) override
+    {
+      if ( p_offset < 0 || static_cast< uint64_t >( p_offset ) > m_file->size() )
+        return false;
+      //
+      m_sent = static_cast< size_t >( p_offset );
+      return true;
+    }
+    //
+  private:
+    std::unique_ptr< mapped_file > m_file;
+    size_t                         m_sent = 0;
+  };
+} // namespace
+
+//--------------------------------------------------------------------
+// Set a body read from a memory mapped file, avoiding to copy it in memory
+HTTP & HTTP::set_body_file( const std::string & p_content_type, const std::string & p_path )
+{
+  auto file = std::make_unique< mapped_file >();
+  //
+  if ( file->open( p_path ) )
+    return set_body( p_content_type, std::make_unique< mapped_file_source >( std::move( file ) ) );
+  //
+  do_if_idle( [ & ]() {
+    if ( m_response_code == c_success )
+      m_response_code = c_error_body_set;
+  } );
+  //
+  return *this;
+}
+
 //--------------------------------------------------------------------
 // Set body parameters to the request, URL encoded
 HTTP & HTTP::set_parameters( const key_values & p_body_parameters )
@@ -95,7 +181,7 @@ HTTP & HTTP::set_parameters( const key_values & p_body_parameters )
 HTTP & HTTP::set_mime( const mime::parts & p_parts )
 {
   do_if_idle( [ & ]() {
-    ASSERT_RETURN_VOID( m_curl_mime == nullptr && request_body().empty() ); // avoid setting body twice
+    ASSERT_RETURN_VOID( m_curl_mime == nullptr && request_body().empty() && request_source() == nullptr ); // avoid setting body twice
     //
     m_curl_mime = curl_mime_init( m_curl );
     //
@@ -112,6 +198,74 @@ HTTP & HTTP::set_mime( const mime::parts & p_parts )
   return *this;
 }
 
+//--------------------------------------------------------------------
+// Pass the received body to a receiver instead of storing it
+HTTP & HTTP::on_data( std::function< bool( std::string_view ) > && p_receiver )
+{
+  do_if_idle( [ & ]() {
+    set_response_receiver( std::move( p_receiver ) );
+  } );
+  //
+  return *this;
+}
+
+//--------------------------------------------------------------------
+// Send duplicates of the request if it is too slow
+HTTP & HTTP::hedge( std::chrono::milliseconds p_after, unsigned p_max_extra )
+{
+  do_if_idle( [ & ]() {
+    if ( m_response_code == c_success )
+      set_request_hedge( p_after.count() > 0 ? static_cast< uint64_t >( p_after.count() ) : 0, 0, p_max_extra );
+  } );
+  //
+  return *this;
+}
+
+HTTP & HTTP::hedge_percentile( double p_percentile, unsigned p_max_extra )
+{
+  do_if_idle( [ & ]() {
+    if ( m_response_code != c_success )
+      return;
+    //
+    if ( p_percentile > 0 && p_percentile <= 100 ) // NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      set_request_hedge( 0, p_percentile, p_max_extra );
+    else
+      m_response_code = c_error_options_set;
+  } );
+  //
+  return *this;
+}
+
+//--------------------------------------------------------------------
+// Write the received body to a file instead of storing it
+HTTP & HTTP::write_to_file( const std::string & p_path )
+{
+  do_if_idle( [ & ]() {
+    int fd = open( p_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ); // NOLINT( cppcoreguidelines-pro-type-vararg )
+    //
+    if ( fd >= 0 )
+      set_response_fd( fd, true ); // closed when the transfer is finished
+    else if ( m_response_code == c_success )
+      m_response_code = c_error_response_file_set;
+  } );
+  //
+  return *this;
+}
+
+//--------------------------------------------------------------------
+// Write the received body to a file descriptor instead of storing it
+HTTP & HTTP::write_to_fd( int p_fd )
+{
+  do_if_idle( [ & ]() {
+    if ( p_fd >= 0 )
+      set_response_fd( p_fd, false ); // left open
+    else if ( m_response_code == c_success )
+      m_response_code = c_error_response_file_set;
+  } );
+  //
+  return *this;
+}
+
 //--------------------------------------------------------------------
 // These accessors return references for efficiency, directly exposing the object's
 // internal. They must only be used after the request has fully completed to ensure data
@@ -142,19 +296,27 @@ std::future< HTTP::response > HTTP::launch()
         // (see Wrapper::cb_protocol)
         auto & http = const_cast< HTTP & >( p_http ); // NOLINT( cppcoreguidelines-pro-type-const-cast )
         //
-        response resp;
-        http.take_response_headers( resp.headers );
-        http.take_response_body   ( resp.body    );
-        resp.code         = http.get_code();
-        resp.content_type = std::move( http.m_response_content_type );
-        resp.redirect_url = std::move( http.m_response_redirect_url );
-        //
-        promise->set_value( std::move( resp ) );
+        promise->set_value( http.take_response() );
       } );
   //
   return future;
 }
 
+//--------------------------------------------------------------------
+// Used by launch() and Wrapper::async(). The transfer is finished.
+HTTP::response HTTP::take_response()
+{
+  response resp;
+  take_response_headers( resp.headers );
+  take_response_body   ( resp.body    );
+  resp.code         = m_response_code;
+  resp.content_type = std::move( m_response_content_type );
+  resp.redirect_url = std::move( m_response_redirect_url );
+  resp.timings      = m_timings;
+  //
+  return resp;
+}
+
 //--------------------------------------------------------------------
 // Called by Wrapper before starting a request.
 // It is guaranteed that there is no operation running.
@@ -165,6 +327,9 @@ bool HTTP::prepare_protocol()
   ok = ok && curl_slist_checked_append( m_curl_headers, "Expect: " );   // to prevent libcurl to send Expect
   ok = ok && easy_setopt( m_curl, CURLOPT_HTTPHEADER, m_curl_headers ); // must be persistent
   //
+  if ( ! m_idempotent || m_curl_mime != nullptr ) // duplicates would be sent to the server
+    set_request_hedge( 0, 0, 0 );
+  //
   return ok;
 }
 
@@ -175,10 +340,10 @@ void HTTP::finalize_protocol()
 {
   char * value = nullptr;
   //
-  if ( curl_easy_getinfo( m_curl, CURLINFO_CONTENT_TYPE, &value ) == CURLE_OK && value != nullptr )
+  if ( curl_easy_getinfo( response_handle(), CURLINFO_CONTENT_TYPE, &value ) == CURLE_OK && value != nullptr )
     m_response_content_type = value;
   //
-  if ( curl_easy_getinfo( m_curl, CURLINFO_REDIRECT_URL, &value ) == CURLE_OK && value != nullptr )
+  if ( curl_easy_getinfo( response_handle(), CURLINFO_REDIRECT_URL, &value ) == CURLE_OK && value != nullptr )
     m_response_redirect_url = value;
   //
   release_curl_extras();
@@ -193,6 +358,7 @@ void HTTP::clear_protocol()
     //
     m_response_content_type.clear();
     m_response_redirect_url.clear();
+    m_idempotent = false;
 }
 
 //--------------------------------------------------------------------
@@ -0,0 +1,191 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "metrics.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// Values below c_linear_max are their own index. Above, the index is made
+// of the position of the most significant bit and of the c_sub_bits next bits.
+size_t histogram_snapshot::bucket_of( uint64_t p_value )
+{
+  if ( p_value < c_linear_max )
+    return static_cast< size_t >( p_value );
+  //
+  auto exponent = static_cast< unsigned >( 63 - __builtin_clzll( p_value ) ); // NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+  if ( exponent >= c_exponent_max )
+    return c_buckets - 1;
+  //
+  auto sub = static_cast< size_t >( p_value >> ( exponent - c_sub_bits ) ) & ( c_sub_buckets - 1 );
+  //
+  return c_linear_max + ( exponent - c_exponent_min ) * c_sub_buckets + sub;
+}
+
+//--------------------------------------------------------------------
+uint64_t histogram_snapshot::bucket_upper( size_t p_bucket )
+{
+  if ( p_bucket < c_linear_max )
+    return p_bucket + 1;
+  //
+  auto exponent = c_exponent_min + static_cast< unsigned >( ( p_bucket - c_linear_max ) / c_sub_buckets );
+  auto sub      = ( p_bucket - c_linear_max ) % c_sub_buckets;
+  //
+  return ( c_sub_buckets + sub + 1 ) << ( exponent - c_sub_bits );
+}
+
+//--------------------------------------------------------------------
+uint64_t histogram_snapshot::percentile( double p_percentile ) const
+{
+  if ( count == 0 )
+    return 0;
+  //
+  auto rank = static_cast< uint64_t >( std::ceil( p_percentile / 100.0 * static_cast< double >( count ) ) ); // NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+  rank      = std::max< uint64_t >( rank, 1 );
+  //
+  uint64_t seen = 0;
+  //
+  for ( size_t bucket = 0; bucket < c_buckets; bucket++ )
+  {
+    seen += counts[ bucket ];
+    if ( seen >= rank )
+      return bucket_upper( bucket );
+  }
+  //
+  return bucket_upper( c_buckets - 1 );
+}
+
+//--------------------------------------------------------------------
+histogram_snapshot & histogram_snapshot::operator+=( const histogram_snapshot & p_other )
+{
+  for ( size_t bucket = 0; bucket < c_buckets; bucket++ )
+    counts[ bucket ] += p_other.counts[ bucket ];
+  //
+  count += p_other.count;
+  sum   += p_other.sum;
+  //
+  return *this;
+}
+
+//--------------------------------------------------------------------
+void histogram::record( uint64_t p_value ) noexcept
+{
+  m_counts[ histogram_snapshot::bucket_of( p_value ) ].add();
+  m_sum.add( p_value );
+}
+
+//--------------------------------------------------------------------
+// The buckets are read one by one while the writer may be updating them:
+// the count is computed from the buckets read, so it is consistent with them.
+void histogram::add_to( histogram_snapshot & p_snapshot ) const
+{
+  for ( size_t bucket = 0; bucket < histogram_snapshot::c_buckets; bucket++ )
+  {
+    auto value                     = m_counts[ bucket ].load();
+    p_snapshot.counts[ bucket ]   += value;
+    p_snapshot.count              += value;
+  }
+  //
+  p_snapshot.sum += m_sum.load();
+}
+
+//--------------------------------------------------------------------
+// Result codes out of range are counted with the nearest bound
+void loop_metrics::record_result( long p_result_code ) noexcept
+{
+  auto code = std::min( std::max( p_result_code, c_result_min ), c_result_max );
+  //
+  results[ static_cast< size_t >( code - c_result_min ) ].add();
+}
+
+//--------------------------------------------------------------------
+// Serialize the metrics in the Prometheus text exposition format
+namespace
+{
+  constexpr double c_us_per_second = 1'000'000.0;
+
+  void append_header( std::string & p_text, const std::string & p_name, const char * p_type, const char * p_help )
+  {
+    p_text += "# HELP " + p_name + " " + p_help + "\n";
+    p_text += "# TYPE " + p_name + " " + p_type + "\n";
+  }
+
+  void append_value( std::string & p_text, const std::string & p_name, const char * p_type, const char * p_help, uint64_t p_value )
+  {
+    append_header( p_text, p_name, p_type, p_help );
+    p_text += p_name + " " + std::to_string( p_value ) + "\n";
+  }
+
+  std::string format_seconds( uint64_t p_us )
+  {
+    std::array< char, 32 > buffer = {}; // NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+    //
+    std::snprintf( buffer.data(), buffer.size(), "%.9g", static_cast< double >( p_us ) / c_us_per_second );
+    //
+    return buffer.data();
+  }
+
+  // Buckets are exported for each power of 2 microseconds, values in seconds
+  void append_histogram( std::string & p_text, const std::string & p_name, const char * p_help, const histogram_snapshot & p_histogram )
+  {
+    append_header( p_text, p_name, "histogram", p_help );
+    //
+    uint64_t cumulated = 0;
+    //
+    for ( size_t bucket = 0; bucket < histogram_snapshot::c_buckets; bucket++ )
+    {
+      cumulated  += p_histogram.counts[ bucket ];
+      auto upper  = histogram_snapshot::bucket_upper( bucket );
+      //
+      if ( ( upper & ( upper - 1 ) ) == 0 ) // a power of 2
+        p_text += p_name + "_bucket{le=\"" + format_seconds( upper ) + "\"} " + std::to_string( cumulated ) + "\n";
+    }
+    //
+    p_text += p_name + "_bucket{le=\"+Inf\"} " + std::to_string( p_histogram.count      ) + "\n";
+    p_text += p_name + "_sum "                 + format_seconds( p_histogram.sum       ) + "\n";
+    p_text += p_name + "_count "               + std::to_string( p_histogram.count     ) + "\n";
+  }
+} // namespace
+
+std::string to_prometheus( const metrics_snapshot & p_metrics, const std::string & p_prefix )
+{
+  std::string text;
+  //
+  append_value( text, p_prefix + "_requests_started_total"     , "counter", "Requests added to a libcurl multi handle", p_metrics.requests_started   );
+  append_value( text, p_prefix + "_requests_retried_total"     , "counter", "Reattempts of failed requests"           , p_metrics.requests_retried   );
+  append_value( text, p_prefix + "_requests_retry_denied_total", "counter", "Reattempts refused by the retry budget"  , p_metrics.requests_retry_denied );
+  append_value( text, p_prefix + "_requests_throttled_total"   , "counter", "Requests delayed by a host limiter"      , p_metrics.requests_throttled );
+  append_value( text, p_prefix + "_requests_hedged_total"      , "counter", "Duplicates started by hedged requests"   , p_metrics.requests_hedged    );
+  append_value( text, p_prefix + "_hedges_won_total"           , "counter", "Hedged requests answered by a duplicate" , p_metrics.hedges_won         );
+  append_value( text, p_prefix + "_requests_active"            , "gauge"  , "Requests started and not yet notified"   , static_cast< uint64_t >( std::max( p_metrics.requests_active, 0L ) ) );
+  append_value( text, p_prefix + "_requests_peak"              , "gauge"  , "Maximum simultaneous transfers"          , static_cast< uint64_t >( std::max( p_metrics.requests_peak  , 0  ) ) );
+  append_value( text, p_prefix + "_callbacks_queued"           , "gauge"  , "Callbacks waiting to be invoked"         , static_cast< uint64_t >( std::max( p_metrics.callbacks_queued, 0L ) ) );
+  append_value( text, p_prefix + "_callbacks_invoked_total"    , "counter", "Threaded callbacks invoked"              , p_metrics.callbacks_invoked  );
+  append_value( text, p_prefix + "_loop_iterations_total"      , "counter", "Iterations of the event loops"           , p_metrics.loop_iterations    );
+  append_value( text, p_prefix + "_connections_opened_total"   , "counter", "Connections opened by libcurl"           , p_metrics.connections_opened );
+  append_value( text, p_prefix + "_connections_closed_total"   , "counter", "Connections closed by libcurl"           , p_metrics.connections_closed );
+  append_value( text, p_prefix + "_connections_open"           , "gauge"  , "Connections currently open"              , p_metrics.connections_opened - std::min( p_metrics.connections_closed, p_metrics.connections_opened ) );
+  append_value( text, p_prefix + "_connections_limit"          , "gauge"  , "Maximum connections, 0 if unlimited"     , static_cast< uint64_t >( std::max( p_metrics.connections_limit, 0L ) ) );
+  append_value( text, p_prefix + "_protocol_crashed"           , "gauge"  , "1 if a protocol crashed while notified"  , p_metrics.protocol_crashed ? 1 : 0 );
+  append_value( text, p_prefix + "_circuits_open"              , "gauge"  , "Open or half-open circuit breakers"      , static_cast< uint64_t >( std::max( p_metrics.circuits_open, 0L ) ) );
+  append_value( text, p_prefix + "_circuit_rejected_total"     , "counter", "Requests rejected by an open circuit"    , p_metrics.circuit_rejected );
+  //
+  auto completed = p_prefix + "_requests_completed_total";
+  append_header( text, completed, "counter", "Completed requests by result code" );
+  for ( const auto & [ code, count ] : p_metrics.results )
+    text += completed + "{code=\"" + std::to_string( code ) + "\"} " + std::to_string( count ) + "\n";
+  //
+  append_histogram( text, p_prefix + "_request_duration_seconds", "Duration of the requests, including queuing and reattempts", p_metrics.request_latency_us );
+  append_histogram( text, p_prefix + "_loop_busy_seconds"       , "Time spent processing events by loop iteration"            , p_metrics.loop_busy_us       );
+  //
+  return text;
+}
+
+} // namespace curlev
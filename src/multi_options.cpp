@@ -0,0 +1,81 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include "multi_options.hpp"
+#include "utils/string_utils.hpp"
+#include "utils/curl_utils.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+// Expect a CSKV list of options to set. Example:
+//   max_host_connections=8,maxconnects=64
+// NOLINTBEGIN( readability-misleading-indentation )
+bool MultiOptions::set( const std::string & p_cskv )
+{
+  return parse_cskv(
+    p_cskv,
+    [ this ]( std::string_view key, std::string_view value )
+    {
+      // Counts must be positive, an invalid value is not stored
+      auto count = [ value ]( long & p_count )
+      {
+        long parsed = 0;
+        //
+        if ( ! svtol( value, parsed ) || parsed < 0 )
+          return false;
+        //
+        p_count = parsed;
+        return true;
+      };
+      //
+      bool ok = true;
+      //
+           if ( key == "max_concurrent_streams" ) ok          = count( m_max_concurrent_streams ) && m_max_concurrent_streams > 0;
+      else if ( key == "max_host_connections"   ) ok          = count( m_max_host_connections   );
+      else if ( key == "max_total_connections"  ) ok          = count( m_max_total_connections  );
+      else if ( key == "maxconnects"            ) ok          = count( m_maxconnects            );
+      else if ( key == "multiplex"              ) m_multiplex = ( value == "1" );
+      else
+          return false;  // unhandled key
+      //
+      return ok;
+    } );
+}
+// NOLINTEND( readability-misleading-indentation )
+
+//--------------------------------------------------------------------
+// Apply the configured options to the given CURL multi handle.
+// It returns false if any option fails to set.
+bool MultiOptions::apply( CURLM * p_multi ) const
+{
+  bool ok = true;
+  //
+  ok = ok && multi_setopt( p_multi, CURLMOPT_MAX_HOST_CONNECTIONS , m_max_host_connections                              );
+  ok = ok && multi_setopt( p_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, m_max_total_connections                             );
+  ok = ok && multi_setopt( p_multi, CURLMOPT_MAXCONNECTS          , m_maxconnects                                       );
+  ok = ok && multi_setopt( p_multi, CURLMOPT_PIPELINING           , m_multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING );
+  //
+  // Added in 7.67.0
+#if LIBCURL_VERSION_NUM >= CURL_VERSION_BITS( 7, 67, 0 )
+  ok = ok && multi_setopt( p_multi, CURLMOPT_MAX_CONCURRENT_STREAMS, m_max_concurrent_streams                            );
+#endif
+  //
+  return ok;
+}
+
+//--------------------------------------------------------------------
+// Reset options to their default values, the ones of libcurl
+void MultiOptions::set_default()
+{
+  m_max_concurrent_streams = c_default_concurrent_streams;
+  m_max_host_connections   = 0;    // no limit
+  m_max_total_connections  = 0;    // no limit
+  m_maxconnects            = 0;    // 4 times the number of added easy handles
+  m_multiplex              = true; // multiplex HTTP/2 transfers
+}
+
+} // namespace curlev
@@ -16,6 +16,30 @@ constexpr auto c_timeout_ms = 30000L;
 // Default maximum number of network redirect
 constexpr auto c_max_redirect = 5L;
 
+//--------------------------------------------------------------------
+// Convert an HTTP version name to its libcurl value
+// NOLINTBEGIN( readability-misleading-indentation )
+namespace
+{
+  bool parse_http_version( std::string_view p_value, long & p_version )
+  {
+         if ( p_value.empty()     ) p_version = CURL_HTTP_VERSION_NONE;              // libcurl default
+    else if ( p_value == "1.0"    ) p_version = CURL_HTTP_VERSION_1_0;
+    else if ( p_value == "1.1"    ) p_version = CURL_HTTP_VERSION_1_1;
+    else if ( p_value == "2"      ) p_version = CURL_HTTP_VERSION_2_0;               // over TLS, or upgrade over clear text
+    else if ( p_value == "2tls"   ) p_version = CURL_HTTP_VERSION_2TLS;              // over TLS only
+    else if ( p_value == "2prior" ) p_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE; // without upgrade (h2c)
+#if LIBCURL_VERSION_NUM >= CURL_VERSION_BITS( 7, 66, 0 )
+    else if ( p_value == "3"      ) p_version = CURL_HTTP_VERSION_3;
+#endif
+    else
+      return false;
+    //
+    return true;
+  }
+} // namespace
+// NOLINTEND( readability-misleading-indentation )
+
 //--------------------------------------------------------------------
 // Expect a CSKV list of options to set. Example:
 //   follow_location=1,insecure=1
@@ -33,12 +57,14 @@ bool Options::set( const std::string & p_cskv )
       else if ( key == "connect_timeout"    ) ok                   = svtol( value, m_connect_timeout );
       else if ( key == "insecure"           ) m_insecure           = ( value == "1" );
       else if ( key == "follow_location"    ) ok                   = svtol( value, m_follow_location );
+      else if ( key == "http_version"       ) ok                   = parse_http_version( value, m_http_version );
       else if ( key == "maxredirs"          ) ok                   = svtol( value, m_maxredirs );
       else if ( key == "proxy"              ) m_proxy              = value;
       else if ( key == "cookies"            ) m_cookies            = ( value == "1" );
       else if ( key == "rcpt_allow_fails"   ) m_rcpt_allow_fails   = ( value == "1" );
       else if ( key == "accept_compression" ) m_accept_compression = ( value == "1" );
       else if ( key == "verbose"            ) m_verbose            = ( value == "1" );
+      else if ( key == "pipewait"           ) m_pipewait           = ( value == "1" );
       else
           return false;  // unhandled key
       //
@@ -58,9 +84,11 @@ bool Options::apply( CURL * p_curl ) const
   ok = ok && easy_setopt( p_curl, CURLOPT_CONNECTTIMEOUT_MS, m_connect_timeout                                );
   ok = ok && easy_setopt( p_curl, CURLOPT_COOKIEFILE       , m_cookies            ? "" : nullptr              );
   ok = ok && easy_setopt( p_curl, CURLOPT_FOLLOWLOCATION   , m_follow_location                                ); // follow 30x
+  ok = ok && easy_setopt( p_curl, CURLOPT_HTTP_VERSION     , m_http_version                                   );
   ok = ok && easy_setopt( p_curl, CURLOPT_SSL_VERIFYHOST   , m_insecure           ? 0L : 2L                   );
   ok = ok && easy_setopt( p_curl, CURLOPT_SSL_VERIFYPEER   , m_insecure           ? 0L : 1L                   );
   ok = ok && easy_setopt( p_curl, CURLOPT_MAXREDIRS        , m_maxredirs                                      );
+  ok = ok && easy_setopt( p_curl, CURLOPT_PIPEWAIT         , m_pipewait           ? 1L : 0L                   );
   ok = ok && easy_setopt( p_curl, CURLOPT_PROXY            , m_proxy.empty()      ? nullptr : m_proxy.c_str() );
   ok = ok && easy_setopt( p_curl, CURLOPT_TIMEOUT_MS       , m_timeout                                        );
   ok = ok && easy_setopt( p_curl, CURLOPT_VERBOSE          , m_verbose            ? 1L : 0L                   );
@@ -83,8 +111,10 @@ void Options::set_default()
   m_connect_timeout    = c_timeout_ms;    // in milliseconds
   m_cookies            = false;           // receive and resend cookies
   m_follow_location    = 0;               // follow HTTP 3xx redirects
+  m_http_version       = CURL_HTTP_VERSION_NONE; // libcurl default
   m_insecure           = false;           // disables certificate validation
   m_maxredirs          = c_max_redirect;  // maximum number of redirects allowed
+  m_pipewait           = false;           // wait for a connection to multiplex on
   m_proxy              .clear();          // the SOCKS or HTTP URl to a proxy
   m_rcpt_allow_fails   = false;           // continue if some recipients fail
   m_timeout            = c_timeout_ms;    // in milliseconds
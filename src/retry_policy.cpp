@@ -0,0 +1,108 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <curl/curl.h>
+#include <string>
+
+#include "retry_policy.hpp"
+#include "utils/string_utils.hpp"
+
+namespace curlev
+{
+
+namespace
+{
+  constexpr uint64_t c_ms_per_second = 1'000;
+} // namespace
+
+//--------------------------------------------------------------------
+// The exponential delay is computed in double to avoid overflows,
+// then capped before being converted.
+uint64_t retry_policy::delay_ms( unsigned p_attempt, double p_random ) const
+{
+  auto exponent = static_cast< double >( std::max( p_attempt, 1U ) - 1 );
+  auto delay    = static_cast< double >( base_delay_ms ) * std::pow( std::max( multiplier, 1.0 ), exponent );
+  delay         = std::min( delay, static_cast< double >( std::max( max_delay_ms, base_delay_ms ) ) );
+  //
+  auto fraction = std::clamp( jitter, 0.0, 1.0 );
+  delay         = delay * ( 1.0 - fraction ) + delay * fraction * std::clamp( p_random, 0.0, 1.0 );
+  //
+  return static_cast< uint64_t >( delay );
+}
+
+//--------------------------------------------------------------------
+// Check if the code guarantees that the request can be resubmitted without side effect
+bool retry_policy::default_retryable( long p_result_code )
+{
+  return p_result_code == CURLE_COULDNT_RESOLVE_HOST
+      || p_result_code == CURLE_COULDNT_RESOLVE_PROXY
+      || p_result_code == CURLE_COULDNT_CONNECT
+      || p_result_code == CURLE_SSL_CONNECT_ERROR
+      || p_result_code == CURLE_PEER_FAILED_VERIFICATION
+      || p_result_code == 429 // Too Many Requests    NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      || p_result_code == 503 // Service Unavailable  NOLINT( cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers )
+      ;
+}
+
+//--------------------------------------------------------------------
+// Retry-After is either a number of seconds or an HTTP date (RFC 9110),
+// which curl_getdate() parses. A date in the past is a null delay.
+bool parse_retry_after( std::string_view p_value, int64_t p_now, uint64_t & p_delay_ms )
+{
+  auto value = trim( p_value );
+  //
+  if ( unsigned long seconds = 0; svtoul( value, seconds ) )
+  {
+    p_delay_ms = seconds > UINT64_MAX / c_ms_per_second ? UINT64_MAX : seconds * c_ms_per_second; // saturated, the value comes from the server
+    return true;
+  }
+  //
+  auto date = curl_getdate( std::string( value ).c_str(), nullptr );
+  if ( date < 0 )
+    return false;
+  //
+  p_delay_ms = static_cast< uint64_t >( std::max< int64_t >( date - p_now, 0 ) ) * c_ms_per_second;
+  return true;
+}
+
+//--------------------------------------------------------------------
+// The bucket starts full
+void retry_budget::configure( double p_ratio, double p_min_per_second, double p_capacity )
+{
+  m_ratio          = std::max( p_ratio         , 0.0 );
+  m_min_per_second = std::max( p_min_per_second, 0.0 );
+  m_capacity       = std::max( p_capacity      , 0.0 );
+  m_tokens         = m_capacity;
+  m_last_ms        = 0;
+}
+
+//--------------------------------------------------------------------
+void retry_budget::deposit() noexcept
+{
+  m_tokens = std::min( m_tokens + m_ratio, m_capacity );
+}
+
+//--------------------------------------------------------------------
+// The time based refill is done when a token is needed
+bool retry_budget::withdraw( uint64_t p_now_ms ) noexcept
+{
+  if ( m_last_ms != 0 && p_now_ms > m_last_ms )
+  {
+    auto elapsed = static_cast< double >( p_now_ms - m_last_ms ) / static_cast< double >( c_ms_per_second );
+    m_tokens     = std::min( m_tokens + elapsed * m_min_per_second, m_capacity );
+  }
+  //
+  m_last_ms = p_now_ms;
+  //
+  if ( m_tokens < 1.0 )
+    return false;
+  //
+  m_tokens -= 1.0;
+  return true;
+}
+
+} // namespace curlev
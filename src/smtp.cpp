@@ -115,6 +115,7 @@ SMTP & SMTP::SEND(
         m_response_code = c_error_url_set;
       //
       m_request_sender = p_from; // may be used later if adding a MIME body
+      set_url_origin( p_url );
   } );
   //
   return *this;
@@ -196,15 +197,26 @@ std::future< SMTP::response > SMTP::launch()
   threaded_callback( false ).start(
       [ promise ]( const SMTP & p_smtp )
       {
-        response resp;
-        resp.code = p_smtp.get_code();
+        // See HTTP::launch
+        auto & smtp = const_cast< SMTP & >( p_smtp ); // NOLINT( cppcoreguidelines-pro-type-const-cast )
         //
-        promise->set_value( std::move( resp ) ); // NOLINT( performance-move-const-arg )
+        promise->set_value( smtp.take_response() );
       } );
   //
   return future;
 }
 
+//--------------------------------------------------------------------
+// Used by launch() and Wrapper::async(). The transfer is finished.
+SMTP::response SMTP::take_response()
+{
+  response resp;
+  resp.code    = m_response_code;
+  resp.timings = m_timings;
+  //
+  return resp;
+}
+
 //--------------------------------------------------------------------
 // Called by Wrapper before starting a request.
 // It is guaranteed that there is no operation running.
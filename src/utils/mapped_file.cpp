@@ -0,0 +1,68 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/mapped_file.hpp"
+
+namespace curlev
+{
+
+//--------------------------------------------------------------------
+mapped_file::~mapped_file()
+{
+  close();
+}
+
+//--------------------------------------------------------------------
+// Map the file, the descriptor is not needed once mapped
+bool mapped_file::open( const std::string & p_path )
+{
+  close();
+  //
+  int fd = ::open( p_path.c_str(), O_RDONLY | O_CLOEXEC ); // NOLINT( cppcoreguidelines-pro-type-vararg )
+  if ( fd < 0 )
+    return false;
+  //
+  struct stat info = {};
+  bool        ok   = fstat( fd, &info ) == 0 && S_ISREG( info.st_mode );
+  //
+  if ( ok && info.st_size > 0 ) // an empty file cannot be mapped
+  {
+    void * data = mmap( nullptr, static_cast< size_t >( info.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+    //
+    if ( data != MAP_FAILED )
+    {
+      madvise( data, static_cast< size_t >( info.st_size ), MADV_SEQUENTIAL ); // read once, in order
+      //
+      m_data = static_cast< char * >( data );
+      m_size = static_cast< size_t >( info.st_size );
+    }
+    else
+    {
+      ok = false;
+    }
+  }
+  //
+  ::close( fd );
+  //
+  return ok;
+}
+
+//--------------------------------------------------------------------
+// Release the mapping
+void mapped_file::close()
+{
+  if ( m_data != nullptr )
+    munmap( m_data, m_size );
+  //
+  m_data = nullptr;
+  m_size = 0;
+}
+
+} // namespace curlev
@@ -4,6 +4,7 @@
  ********************************************************************/
 
 #include <algorithm>
+#include <cctype>
 #include <cstring>
 #include <limits>
 
@@ -130,4 +131,27 @@ bool is_safe_header_component( std::string_view p_string )
   return p_string.find_first_of( "\r\n\0", 0, 3 ) == std::string_view::npos;
 }
 
+//--------------------------------------------------------------------
+// Extracts the origin of an URL: its scheme, host and port, lower cased, without user info.
+// The URL is not validated, libcurl will do it.
+std::string url_origin( std::string_view p_url )
+{
+  auto separator = p_url.find( "://" );
+  auto start     = separator == std::string_view::npos ? 0 : separator + 3;
+  auto authority = p_url.substr( start, p_url.find_first_of( "/?#", start ) - start );
+  //
+  if ( auto at = authority.rfind( '@' ); at != std::string_view::npos )
+    authority.remove_prefix( at + 1 );
+  //
+  std::string origin;
+  origin.reserve( start + authority.size() );
+  origin.append( p_url.substr( 0, start ) );
+  origin.append( authority );
+  //
+  std::transform( origin.begin(), origin.end(), origin.begin(),
+                  []( unsigned char c ) { return static_cast< char >( std::tolower( c ) ); } );
+  //
+  return origin;
+}
+
 } // namespace curlev
@@ -0,0 +1,107 @@
+/*********************************************************************
+ * Copyright (c) 2025, Pierre DEL PERUGIA and the curlev project contributors
+ * SPDX-License-Identifier: Apache-2.0
+ ********************************************************************/
+
+// This file is compiled in C++20 when the compiler supports it
+
+#include <gtest/gtest.h>
+
+#include "async.hpp"
+#include "http.hpp"
+#include "smtp.hpp"
+#include "test_utils.hpp"
+
+using namespace curlev;
+
+#if __cplusplus >= 202002L && __has_include( <coroutine> )
+
+#include <coroutine>
+#include <future>
+#include <thread>
+
+namespace
+{
+
+  // A minimal coroutine type, signaling its end through a future
+  struct task
+  {
+    struct promise_type
+    {
+      std::promise< void > done;
+      //
+      task                get_return_object  ()          { return task{ done.get_future() }; }
+      std::suspend_never  initial_suspend    () noexcept { return {}; }
+      std::suspend_never  final_suspend      () noexcept { return {}; }
+      void                return_void        ()          { done.set_value(); }
+      void                unhandled_exception()          { done.set_exception( std::current_exception() ); }
+    };
+    //
+    std::future< void > done;
+  };
+
+} // namespace
+
+//--------------------------------------------------------------------
+// co_await on HTTP requests
+TEST( coroutine, http )
+{
+  ASync async;
+  async.start();
+  //
+  auto http        = HTTP::create( async );
+  auto test_thread = std::this_thread::get_id();
+  //
+  auto coroutine = [ & ]() -> task
+  {
+    http->GET( c_server_httpbun + "get", { { "a", "b" } } );
+    //
+    auto response = co_await http->async();
+    EXPECT_EQ( response.code, 200 );
+    EXPECT_EQ( response.content_type, "application/json" );
+    EXPECT_EQ( json_extract( response.body, "$.args.a" ), "b" );
+    EXPECT_NE( std::this_thread::get_id(), test_thread ); // resumed by a callback thread
+    //
+    // The same object can be reused from the coroutine
+    response = co_await http->GET( c_server_httpbun + "status/404" ).threaded_callback( false ).async();
+    EXPECT_EQ( response.code, 404 );
+    //
+    // The transfer does not start: the coroutine is not suspended
+    response = co_await http->GET( c_server_httpbun + "get" ).options( "bad_option" ).async();
+    EXPECT_EQ( response.code, c_error_options_format );
+  };
+  //
+  coroutine().done.get();
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// co_await on a SMTP request
+TEST( coroutine, smtp )
+{
+  ASync async;
+  async.start();
+  //
+  auto smtp = SMTP::create( async );
+  //
+  auto coroutine = [ & ]() -> task
+  {
+    smtp->SEND( "smtp://localhost:2525",
+                smtp::address( "sender@example.com" ) )
+        .set_body( { smtp::address( "address@example.com" ) },
+                   "Subject: SMTP example message\r\n"
+                   "\r\n"
+                   "The body of the message.\r\n" );
+    //
+    auto response = co_await smtp->async();
+    //
+    EXPECT_EQ( response.code, 7 ); // no server
+  };
+  //
+  coroutine().done.get();
+  //
+  async.stop();
+}
+
+#endif
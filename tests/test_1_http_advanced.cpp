@@ -3,8 +3,10 @@
  * SPDX-License-Identifier: Apache-2.0
  ********************************************************************/
 
+#include <algorithm>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <memory>
 
 #if __has_include( <rapidjson/document.h> )
   #include <rapidjson/writer.h>
@@ -17,6 +19,10 @@
 
 using namespace curlev;
 
+#ifndef PROJECT_ROOT_DIR
+  #define PROJECT_ROOT_DIR "tests/"
+#endif
+
 //--------------------------------------------------------------------
 TEST( http_advanced, request )
 {
@@ -89,6 +95,46 @@ TEST( http_advanced, results )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+TEST( http_advanced, timings )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    auto http = HTTP::create( async );
+    //
+    http->GET( c_server_httpbun + "delay/1" ).start();
+    EXPECT_EQ( http->get_timings().total, 0 ); // not available while running
+    //
+    ASSERT_EQ( http->join().get_code(), 200 );
+    //
+    const auto & t = http->get_timings();
+    EXPECT_GT( t.connect      , 0              );
+    EXPECT_LE( t.namelookup   , t.connect      );
+    EXPECT_LE( t.connect      , t.pretransfer  );
+    EXPECT_LE( t.pretransfer  , t.starttransfer );
+    EXPECT_LE( t.starttransfer, t.total        );
+    EXPECT_GE( t.starttransfer, 1'000'000      ); // the server waits 1s before answering
+    EXPECT_LT( t.queue        , 1'000'000      );
+    EXPECT_EQ( t.redirect     , 0              );
+    //
+    // Reset by a new request
+    http->GET( c_server_httpbun + "get" );
+    EXPECT_EQ( http->get_timings().total, 0 );
+  }
+  //
+  {
+    auto response = HTTP::create( async )->GET( c_server_httpbun + "get" ).launch().get();
+    //
+    EXPECT_EQ( response.code, 200 );
+    EXPECT_GT( response.timings.total, 0 );
+    EXPECT_LE( response.timings.starttransfer, response.timings.total );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 TEST( http_advanced, headers )
 {
@@ -180,6 +226,86 @@ TEST( http_advanced, post_json )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// A body source generating the payload in small chunks
+class generator : public body_source
+{
+public:
+  generator( std::string p_payload, bool p_known_size ) :
+    m_payload( std::move( p_payload ) ), m_known_size( p_known_size ) {}
+  //
+  int64_t size() const override
+  {
+    return m_known_size ? static_cast< int64_t >( m_payload.size() ) : c_unknown_size;
+  }
+  //
+  bool read( char * p_buffer, size_t p_size, size_t & p_read ) override
+  {
+    p_read = std::min( { p_size, m_payload.size() - m_sent, size_t{ 7 } } );
+    m_payload.copy( p_buffer, p_read, m_sent );
+    m_sent += p_read;
+    return true;
+  }
+  //
+  bool rewind() override
+  {
+    m_sent = 0;
+    return true;
+  }
+  //
+private:
+  std::string m_payload;
+  bool        m_known_size;
+  size_t      m_sent = 0;
+};
+
+//--------------------------------------------------------------------
+TEST( http_advanced, post_source )
+{
+  ASync async;
+  async.start();
+  //
+  const std::string payload = R"({ "a": "0123456789", "b": "abcdefghijklmnopqrstuvwxyz" })";
+  //
+  for ( bool known_size : { true, false } ) // unknown size uses chunked transfer encoding
+  {
+    auto http = HTTP::create( async );
+    auto code = http->POST( c_server_httpbun + "post" )
+                          .set_body( "application/json", std::make_unique< generator >( payload, known_size ) )
+                          .exec().get_code();
+    ASSERT_EQ( code, 200 );
+    //
+    EXPECT_EQ( json_extract( http->get_body(), "$.headers.Content-Type" ), "application/json" );
+    EXPECT_EQ( json_extract( http->get_body(), "$.data" ), payload );
+  }
+  //
+  {
+    auto http = HTTP::create( async );
+    auto code = http->POST( c_server_httpbun + "post" )
+                          .set_body( "application/json", std::unique_ptr< body_source >() )
+                          .exec().get_code();
+    EXPECT_EQ( code, c_error_body_set );
+  }
+  //
+  {
+    auto http = HTTP::create( async );
+    auto code = http->PUT( c_server_httpbun + "put" )
+                          .set_body_file( "text/plain", PROJECT_ROOT_DIR "/tests/data.txt" )
+                          .exec().get_code();
+    ASSERT_EQ( code, 200 );
+    //
+    EXPECT_EQ( json_extract( http->get_body(), "$.headers.Content-Type" ), "text/plain" );
+    EXPECT_EQ( json_extract( http->get_body(), "$.data" ), "abc123" );
+    //
+    code = http->PUT( c_server_httpbun + "put" )
+                .set_body_file( "text/plain", PROJECT_ROOT_DIR "/tests/missing.txt" )
+                .exec().get_code();
+    EXPECT_EQ( code, c_error_body_set );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 TEST( http_advanced, rest )
 {
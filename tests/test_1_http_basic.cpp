@@ -100,6 +100,12 @@ TEST( http_basic, cskv_error )
     code = http->GET( c_server_httpbun + "get" ).options( "maxredirs=x" ).exec().get_code(); // invalid value
     EXPECT_EQ( code, c_error_options_format );
     //
+    code = http->GET( c_server_httpbun + "get" ).options( "http_version=1.2" ).exec().get_code(); // unknown version
+    EXPECT_EQ( code, c_error_options_format );
+    //
+    code = http->GET( c_server_httpbun + "get" ).options( "http_version=1.1,pipewait=1" ).exec().get_code();
+    EXPECT_EQ( code, 200 );
+    //
     code = http->GET( c_server_httpbun + "get" ).authentication( "beta" ).exec().get_code(); // unknown
     EXPECT_EQ( code, c_error_authentication_format );
     //
@@ -119,6 +125,39 @@ TEST( http_basic, cskv_error )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// Same configurations using the typed setters
+TEST( http_basic, typed_setters )
+{
+  using namespace std::chrono_literals;
+  //
+  ASync async;
+  async.start();
+  //
+  {
+    auto http = HTTP::create( async );
+    long code;
+    //
+    code = http->GET( c_server_httpbun + "basic-auth/joe/abc123" )
+                .authentication( []( Authentication & p ) { p.mode( Authentication::Mode::basic ).user( "joe" ).secret( "abc123" ); } )
+                .exec().get_code();
+    EXPECT_EQ( code, 200 );
+    //
+    code = http->GET( c_server_httpbun + "delay/2" )
+                .options( []( Options & p ) { p.timeout( 500ms ).follow_location( 1 ); } )
+                .exec().get_code();
+    EXPECT_EQ( code, CURLE_OPERATION_TIMEDOUT );
+    //
+    code = http->GET( c_server_httpbun + "get" ).options( []( Options & p ) { p.maxredirs( -5 ); } ).exec().get_code();
+    EXPECT_EQ( code, c_error_options_set );
+    //
+    code = http->GET( c_server_httpbun + "get" ).options( []( Options & p ) { p.http_version( CURL_HTTP_VERSION_1_1 ); } ).exec().get_code();
+    EXPECT_EQ( code, 200 );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 // Ensure that all methods are properly implemented. Once this is done it is possible
 // to focus on the various function signatures of GET and POST.
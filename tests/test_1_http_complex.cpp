@@ -3,8 +3,13 @@
  * SPDX-License-Identifier: Apache-2.0
  ********************************************************************/
 
+#include <atomic>
+#include <cstdio>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "async.hpp"
 #include "http.hpp"
@@ -41,6 +46,219 @@ TEST( http_complex, simultaneous )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// Simultaneous requests distributed over several loops
+TEST( http_complex, multiple_loops )
+{
+  ASync async;
+  async.start( 4 );
+  //
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    //
+    for ( auto i = 0; i < 8; i++ )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "delay/1" ).start();
+    }
+    //
+    for ( auto & http : https )
+      EXPECT_EQ( http->join().get_code(), 200 );
+    //
+    EXPECT_EQ( async.peak_requests(), 8 );
+    EXPECT_EQ( async.active_requests(), 0 );
+    //
+    // The abort is sent to the loop running the request
+    https[ 3 ]->GET( c_server_httpbun + "delay/2" ).start();
+    uv_sleep( 200 );
+    EXPECT_EQ( https[ 3 ]->abort().join().get_code(), CURLE_ABORTED_BY_CALLBACK );
+    //
+    EXPECT_FALSE( async.protocol_crashed() );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Requests started at once
+TEST( http_complex, batch )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    std::atomic_int                        cb_count = 0;
+    std::vector< std::shared_ptr< HTTP > > https;
+    std::vector< std::string >             codes = { "200", "204", "400", "404", "503" };
+    //
+    for ( const std::string & expected_code : codes )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "status/" + expected_code );
+    }
+    //
+    // One of them is invalid, its callback is invoked immediately
+    https.emplace_back( HTTP::create( async ) );
+    https.back()->GET( c_server_httpbun + "get" ).options( "bad_option=1" );
+    //
+    HTTP::start_batch( https, [ &cb_count ]( const auto & ) { cb_count++; } );
+    //
+    for ( auto i = 0; i < codes.size(); i++ )
+      EXPECT_EQ( std::to_string( https[ i ]->join().get_code() ), codes[ i ] );
+    //
+    EXPECT_EQ( https.back()->join().get_code(), c_error_options_format );
+    EXPECT_EQ( cb_count, https.size() );
+    EXPECT_EQ( async.active_requests(), 0 );
+    EXPECT_FALSE( async.protocol_crashed() );
+    //
+    // Requests can be started again
+    HTTP::start_batch( { https[ 0 ], https[ 1 ] } );
+    //
+    EXPECT_EQ( https[ 0 ]->join().get_code(), 200 );
+    EXPECT_EQ( https[ 1 ]->join().get_code(), 204 );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Slow callbacks don't block each other with several callback threads
+TEST( http_complex, callback_threads )
+{
+  ASync async;
+  async.start( 1, 4 );
+  //
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    //
+    auto start = uv_hrtime();
+    //
+    for ( auto i = 0; i < 4; i++ )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "get" ).start( []( const auto & ) { uv_sleep( 500 ); } );
+    }
+    //
+    for ( auto & http : https )
+      EXPECT_EQ( http->join().get_code(), 200 );
+    //
+    auto duration_ns = uv_hrtime() - start;
+    EXPECT_LT( duration_ns, 1'500'000'000 ); // < 1.5s, instead of 2s with a single thread
+    //
+    uv_sleep( 100 ); // statistics are updated after join() is released
+    //
+    auto stats = async.callback_statistics();
+    EXPECT_EQ( stats.threads, 4 );
+    EXPECT_EQ( stats.queued , 0 );
+    EXPECT_EQ( stats.invoked, 4 );
+    EXPECT_GE( stats.run_avg_us, 500'000 );
+    EXPECT_GE( stats.run_max_us, stats.run_avg_us );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Callbacks invoked by a custom executor
+TEST( http_complex, callback_executor )
+{
+  std::mutex                          mutex;
+  std::vector< ASync::callback_task > tasks;
+  std::set< std::thread::id >         threads;
+  //
+  ASync async;
+  EXPECT_TRUE( async.set_callback_executor(
+      [ & ]( ASync::callback_task && p_task )
+      {
+        std::lock_guard lock( mutex );
+        tasks.push_back( std::move( p_task ) );
+      } ) );
+  async.start();
+  EXPECT_FALSE( async.set_callback_executor( nullptr ) ); // already started
+  //
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    //
+    for ( auto i = 0; i < 3; i++ )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "get" ).start(
+          [ & ]( const auto & )
+          {
+            std::lock_guard lock( mutex );
+            threads.insert( std::this_thread::get_id() );
+          } );
+    }
+    //
+    // The executor runs the tasks from this thread
+    for ( auto executed = 0; executed < 3; )
+    {
+      std::vector< ASync::callback_task > ready;
+      {
+        std::lock_guard lock( mutex );
+        ready.swap( tasks );
+      }
+      for ( auto & task : ready )
+        task();
+      executed += static_cast< int >( ready.size() );
+      uv_sleep( 10 );
+    }
+    //
+    for ( auto & http : https )
+      EXPECT_EQ( http->join().get_code(), 200 );
+    //
+    EXPECT_EQ( threads.size(), 1 );
+    EXPECT_EQ( *threads.begin(), std::this_thread::get_id() );
+    //
+    auto stats = async.callback_statistics();
+    EXPECT_EQ( stats.threads, 0 );
+    EXPECT_EQ( stats.queued , 0 );
+    EXPECT_EQ( stats.invoked, 3 );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Counters and histograms of the event loops
+TEST( http_complex, metrics )
+{
+  ASync async;
+  async.start( 2 );
+  //
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    //
+    for ( auto code : { "200", "200", "404" } )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "status/" + code ).start();
+    }
+    //
+    for ( auto & http : https )
+      http->join();
+    //
+    auto metrics = async.metrics();
+    EXPECT_EQ( metrics.requests_started  , 3 );
+    EXPECT_EQ( metrics.requests_completed, 3 );
+    EXPECT_EQ( metrics.requests_retried  , 0 );
+    EXPECT_EQ( metrics.results.size()    , 2 );
+    EXPECT_EQ( metrics.results[ 200 ]    , 2 );
+    EXPECT_EQ( metrics.results[ 404 ]    , 1 );
+    EXPECT_EQ( metrics.request_latency_us.count, 3 );
+    EXPECT_GT( metrics.request_latency_us.percentile( 50 ), 0 );
+    EXPECT_GT( metrics.loop_iterations   , 0 );
+    EXPECT_GT( metrics.loop_busy_us.count, 0 );
+    //
+    auto text = to_prometheus( metrics );
+    EXPECT_NE( text.find( "curlev_requests_started_total 3\n"                ), std::string::npos );
+    EXPECT_NE( text.find( "curlev_requests_completed_total{code=\"404\"} 1\n" ), std::string::npos );
+    EXPECT_NE( text.find( "curlev_request_duration_seconds_count 3\n"        ), std::string::npos );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 // Request continues and ASync is stopped
 TEST( http_complex, detached )
@@ -135,6 +353,129 @@ TEST( http_complex, cookies )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// Released easy handles are reused, without their previous state
+TEST( http_complex, handle_pool )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    auto http = HTTP::create( async );
+    auto code = http->GET( c_server_httpbun + "cookies/set", { { "f1", "81" } } ).options( "cookies=1" ).exec().get_code();
+    ASSERT_EQ( code, 302 );
+  }
+  //
+  EXPECT_EQ( async.pool_misses(), 1 );
+  EXPECT_EQ( async.pool_hits  (), 0 );
+  //
+  {
+    // Same handle, but cookies and options were reset
+    auto http = HTTP::create( async );
+    auto code = http->GET( c_server_httpbun + "cookies" ).options( "cookies=1" ).exec().get_code();
+    ASSERT_EQ( code, 200 );
+    //
+    EXPECT_EQ( json_count( http->get_body(), "$.cookies" ), 0 );
+  }
+  //
+  EXPECT_EQ( async.pool_misses(), 1 );
+  EXPECT_EQ( async.pool_hits  (), 1 );
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Connections opened before the requests are reused
+TEST( http_complex, prewarm )
+{
+  ASync async;
+  EXPECT_EQ( async.prewarm( { c_server_httpbun } ), 0 ); // not started
+  async.start( 2 );
+  //
+  EXPECT_EQ( async.prewarm( {} ), 0 );
+  EXPECT_EQ( async.prewarm( { c_server_httpbun + "get", c_server_httpbun + "status/200" }, 2 ), 8 ); // 2 loops
+  //
+  uv_sleep( 1'000 ); // connections are opened asynchronously
+  //
+  {
+    auto http = HTTP::create( async );
+    ASSERT_EQ( http->GET( c_server_httpbun + "get" ).exec().get_code(), 200 );
+    EXPECT_EQ( http->get_timings().connect, 0 ); // connection reused
+  }
+  //
+  EXPECT_FALSE( async.stop() );
+}
+
+//--------------------------------------------------------------------
+// Connection limits, set before starting and changed while running
+TEST( http_complex, multi_options )
+{
+  ASync async;
+  EXPECT_FALSE( async.multi_options( "alpha=1" ) );           // unknown
+  EXPECT_FALSE( async.multi_options( "maxconnects=-1" ) );    // invalid value
+  EXPECT_FALSE( async.multi_options( "max_concurrent_streams=0" ) );
+  EXPECT_TRUE ( async.multi_options( "max_total_connections=1,multiplex=0" ) );
+  async.start();
+  //
+  auto simultaneous = [ &async ]()
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    //
+    for ( auto i = 0; i < 3; i++ )
+    {
+      https.emplace_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "get" ).start();
+    }
+    //
+    for ( auto & http : https )
+      EXPECT_EQ( http->join().get_code(), 200 );
+  };
+  //
+  simultaneous(); // the requests wait for the single connection
+  //
+  auto metrics = async.metrics();
+  EXPECT_EQ( metrics.connections_opened, 1 );
+  EXPECT_EQ( metrics.connections_closed, 0 );
+  EXPECT_EQ( metrics.connections_limit , 1 );
+  EXPECT_NE( to_prometheus( metrics ).find( "curlev_connections_open 1\n" ), std::string::npos );
+  //
+  EXPECT_TRUE( async.multi_options( "max_total_connections=0" ) );
+  uv_sleep( 100 ); // applied asynchronously
+  //
+  simultaneous(); // new connections are opened
+  //
+  metrics = async.metrics();
+  EXPECT_GT( metrics.connections_opened, 1 );
+  EXPECT_EQ( metrics.connections_limit , 0 );
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Named profiles, changed or overridden between the requests of an instance
+TEST( http_complex, profile )
+{
+  const std::string joe = "mode=basic,user=joe,secret=abc123";
+  //
+  ASync async;
+  EXPECT_FALSE( async.define_profile( "joe", "", joe, "" ) );       // not started
+  async.start();
+  EXPECT_FALSE( async.define_profile( "bad", "alpha=1", "", "" ) ); // unknown
+  EXPECT_TRUE ( async.define_profile( "joe", "timeout=5000", joe, "" ) );
+  //
+  auto http = HTTP::create( async );
+  auto get  = [ &http ]() -> auto & { return http->GET( c_server_httpbun + "basic-auth/joe/abc123" ); };
+  //
+  EXPECT_EQ( get().profile( "joe" ).exec().get_code(), 200 );
+  EXPECT_EQ( get().profile( "joe" ).exec().get_code(), 200 ); // already applied
+  EXPECT_EQ( get().exec().get_code(), 401 );                  // back to the defaults
+  EXPECT_EQ( get().profile( "joe" ).authentication( "secret=bad" ).exec().get_code(), 401 );
+  EXPECT_EQ( get().profile( "joe" ).exec().get_code(), 200 );
+  EXPECT_EQ( get().profile( "jack" ).exec().get_code(), c_error_profile_unknown );
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 // Validate the p_query_parameters handling in requests without body
 TEST( http_complex, redirect )
@@ -392,6 +733,124 @@ TEST( http_complex, max_size )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// Receiving the body as it arrives
+TEST( http_complex, on_data )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    auto http     = HTTP::create( async );
+    auto expected = http->GET( c_server_compress ).exec().get_body();
+    ASSERT_FALSE( expected.empty() );
+    //
+    // The first chunk pauses the transfer, it is passed again once resumed
+    std::string      received;
+    std::atomic_bool paused  = false;
+    std::atomic_int  refused = 0;
+    //
+    http->GET( c_server_compress )
+        .on_data(
+            [ & ]( std::string_view p_data )
+            {
+              if ( refused == 0 )
+              {
+                refused++;
+                paused = true;
+                return false;
+              }
+              //
+              received.append( p_data );
+              return true;
+            } )
+        .start();
+    //
+    while ( ! paused )
+      uv_sleep( 10 );
+    //
+    uv_sleep( 100 );
+    EXPECT_EQ( http->get_code(), c_running ); // still paused
+    EXPECT_TRUE( received.empty() );
+    //
+    http->resume().join();
+    //
+    EXPECT_EQ( http->get_code(), 200 );
+    EXPECT_EQ( refused, 1 );
+    EXPECT_EQ( received, expected );
+    EXPECT_TRUE( http->get_body().empty() );
+    //
+    // The maximal size applies to the total received size
+    size_t total = 0;
+    //
+    http->GET( c_server_compress )
+        .maximal_response_size( 1024 )
+        .on_data( [ & ]( std::string_view p_data ) { total += p_data.size(); return true; } )
+        .exec();
+    //
+    EXPECT_EQ( http->get_code(), CURLE_WRITE_ERROR );
+    EXPECT_LE( total, 1024 );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Writing the body to a file
+TEST( http_complex, write_to_file )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    auto http     = HTTP::create( async );
+    auto expected = http->GET( c_server_compress ).exec().get_body();
+    ASSERT_FALSE( expected.empty() );
+    //
+    auto read_file = []( std::FILE * p_file )
+    {
+      std::string content( 1'000'000, '\0' );
+      std::rewind( p_file );
+      content.resize( std::fread( content.data(), 1, content.size(), p_file ) );
+      return content;
+    };
+    //
+    // To a file, created or truncated
+    auto path = testing::TempDir() + "curlev_write_to_file.txt";
+    //
+    for ( auto i = 0; i < 2; i++ )
+    {
+      EXPECT_EQ( http->GET( c_server_compress ).write_to_file( path ).exec().get_code(), 200 );
+      EXPECT_TRUE( http->get_body().empty() );
+      //
+      std::FILE * file = std::fopen( path.c_str(), "rb" );
+      ASSERT_NE( file, nullptr );
+      EXPECT_EQ( read_file( file ), expected );
+      std::fclose( file );
+    }
+    //
+    // The maximal size applies to the total received size
+    http->GET( c_server_compress ).write_to_file( path ).maximal_response_size( 1024 ).exec();
+    EXPECT_EQ( http->get_code(), CURLE_WRITE_ERROR );
+    //
+    EXPECT_EQ( http->GET( c_server_compress ).write_to_file( "/not/a/directory/file.txt" ).exec().get_code(),
+               c_error_response_file_set );
+    //
+    std::remove( path.c_str() );
+    //
+    // To a file descriptor, left open
+    std::FILE * file = std::tmpfile();
+    ASSERT_NE( file, nullptr );
+    //
+    EXPECT_EQ( http->GET( c_server_compress ).write_to_fd( fileno( file ) ).exec().get_code(), 200 );
+    EXPECT_EQ( read_file( file ), expected );
+    //
+    std::fclose( file );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 TEST( http_complex, retry )
 {
@@ -416,6 +875,357 @@ TEST( http_complex, retry )
   async.stop();
 }
 
+//--------------------------------------------------------------------
+// The circuit breaker opens after consecutive failures, then probes the origin
+TEST( http_complex, circuit_breaker )
+{
+  ASync async;
+  EXPECT_FALSE( async.set_circuit_breaker( 0 ) );
+  EXPECT_TRUE ( async.set_circuit_breaker( 2, 500 ) );
+  async.start();
+  //
+  {
+    auto http = HTTP::create( async );
+    //
+    EXPECT_EQ( http->GET( c_server_httpbun + "status/503" ).exec().get_code(), 503 );
+    EXPECT_EQ( http->GET( c_server_httpbun + "status/503" ).exec().get_code(), 503 );
+    EXPECT_EQ( http->GET( c_server_httpbun + "get"        ).exec().get_code(), c_error_circuit_open );
+    //
+    auto circuits = async.circuits();
+    ASSERT_EQ( circuits.size(), 1 );
+    EXPECT_EQ( circuits.begin()->second, circuit_state::open );
+    //
+    auto metrics = async.metrics();
+    EXPECT_EQ( metrics.circuits_open   , 1 );
+    EXPECT_EQ( metrics.circuit_rejected, 1 );
+    EXPECT_EQ( metrics.requests_started, 2 );
+    //
+    uv_sleep( 600 );
+    EXPECT_EQ( async.circuits().begin()->second, circuit_state::half_open );
+    EXPECT_EQ( http->GET( c_server_httpbun + "get" ).exec().get_code(), 200 ); // the probe closes it
+    EXPECT_TRUE( async.circuits().empty() );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// Host limits delay the requests over the rate or the number in flight
+TEST( http_complex, host_limits )
+{
+  ASync async;
+  EXPECT_FALSE( async.set_host_limits( c_server_httpbun, { -1, 0, 0 } ) );
+  EXPECT_TRUE ( async.set_host_limits( c_server_httpbun, { 10, 1, 2 } ) ); // 10 per second, no burst, 2 in flight
+  async.start( 2 );
+  EXPECT_FALSE( async.set_host_limits( c_server_httpbun, { 10, 1, 2 } ) ); // already started
+  //
+  // Rate: one request every 100ms
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    auto start = uv_hrtime();
+    //
+    for ( int i = 0; i < 4; i++ )
+    {
+      https.push_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "get" ).start();
+    }
+    //
+    for ( auto & http : https )
+      EXPECT_EQ( http->join().get_code(), 200 );
+    //
+    EXPECT_GT( uv_hrtime() - start, 280'000'000 ); // > 280ms
+  }
+  //
+  // In flight: the third request waits for one of the first two, the last one is aborted while waiting
+  {
+    std::vector< std::shared_ptr< HTTP > > https;
+    auto start = uv_hrtime();
+    //
+    for ( int i = 0; i < 4; i++ )
+    {
+      https.push_back( HTTP::create( async ) );
+      https.back()->GET( c_server_httpbun + "delay/1" ).start();
+    }
+    //
+    EXPECT_EQ( https[ 3 ]->abort().join().get_code(), CURLE_ABORTED_BY_CALLBACK );
+    //
+    for ( int i = 0; i < 3; i++ )
+      EXPECT_EQ( https[ i ]->join().get_code(), 200 );
+    //
+    EXPECT_GT( uv_hrtime() - start, 1'900'000'000 ); // > 1.9s
+    EXPECT_GE( https[ 2 ]->get_timings().queue, 900'000 ); // in µs
+  }
+  //
+  // A reattempt of a request answered by 429 waits for a token again
+  {
+    retry_policy policy;
+    policy.max_retries   = 1;
+    policy.base_delay_ms = 10;
+    policy.jitter        = 0;
+    //
+    auto http      = HTTP::create( async );
+    auto throttled = async.metrics().requests_throttled;
+    auto start     = uv_hrtime();
+    //
+    EXPECT_EQ( http->GET( c_server_httpbun + "status/429" ).retry( policy ).exec().get_code(), 429 );
+    EXPECT_GT( uv_hrtime() - start, 80'000'000 ); // > 80ms: one token every 100ms
+    EXPECT_EQ( async.metrics().requests_throttled, throttled + 1 );
+  }
+  //
+  auto metrics = async.metrics();
+  EXPECT_GE( metrics.requests_throttled, 6 );
+  EXPECT_EQ( metrics.requests_started  , 8 );
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// High priority requests leave the host limits and the callback queue first
+TEST( http_complex, priority )
+{
+  ASync async;
+  EXPECT_TRUE( async.set_host_limits( c_server_httpbun, { 0, 0, 1 } ) ); // 1 in flight
+  async.start( 1, 1 );                                                   // 1 callback thread
+  //
+  std::mutex                mutex;
+  std::vector< std::string > order;
+  auto record = [ & ]( const std::string & p_name ) { std::lock_guard lock( mutex ); order.push_back( p_name ); };
+  //
+  // Host limits: the first request holds the slot, the others wait
+  {
+    auto first = HTTP::create( async );
+    auto low   = HTTP::create( async );
+    auto high  = HTTP::create( async );
+    //
+    first->GET( c_server_httpbun + "delay/1" ).start( [ & ]( const auto & ) { record( "first" ); } );
+    low  ->GET( c_server_httpbun + "get"     ).priority( priority_level::low  ).start( [ & ]( const auto & ) { record( "low"  ); } );
+    high ->GET( c_server_httpbun + "get"     ).priority( priority_level::high ).start( [ & ]( const auto & ) { record( "high" ); } );
+    //
+    EXPECT_EQ( first->join().get_code(), 200 );
+    EXPECT_EQ( low  ->join().get_code(), 200 );
+    EXPECT_EQ( high ->join().get_code(), 200 );
+    EXPECT_EQ( order, ( std::vector< std::string >{ "first", "high", "low" } ) );
+  }
+  //
+  // Callback queue: the first callback blocks the thread while the others complete
+  order.clear();
+  {
+    auto first = HTTP::create( async );
+    auto low   = HTTP::create( async );
+    auto high  = HTTP::create( async );
+    //
+    first->GET( c_server_httpbun + "get" ).start( [ & ]( const auto & ) { record( "first" ); uv_sleep( 1000 ); } );
+    uv_sleep( 200 );
+    low  ->GET( "http://localhost:9999/" ).priority( priority_level::low  ).start( [ & ]( const auto & ) { record( "low"  ); } );
+    uv_sleep( 200 );
+    high ->GET( "http://localhost:9999/" ).priority( priority_level::high ).start( [ & ]( const auto & ) { record( "high" ); } );
+    //
+    EXPECT_EQ( first->join().get_code(), 200 );
+    EXPECT_EQ( low  ->join().get_code(), CURLE_COULDNT_CONNECT );
+    EXPECT_EQ( high ->join().get_code(), CURLE_COULDNT_CONNECT );
+    EXPECT_EQ( order, ( std::vector< std::string >{ "first", "high", "low" } ) );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// The deadline bounds the whole request: queuing, attempts and reattempts
+TEST( http_complex, deadline )
+{
+  using namespace std::chrono_literals;
+  //
+  ASync async;
+  EXPECT_TRUE( async.set_host_limits( c_server_httpbun, { 0, 0, 1 } ) ); // 1 in flight
+  async.start();
+  //
+  auto http = HTTP::create( async );
+  //
+  // Already expired: not started
+  EXPECT_EQ( http->GET( c_server_httpbun + "get" ).deadline( std::chrono::steady_clock::now() - 1ms ).exec().get_code(), c_error_deadline );
+  EXPECT_EQ( async.metrics().requests_started, 0 );
+  //
+  // The attempt timeout is shrunk, then restored for the next request
+  {
+    auto start = uv_hrtime();
+    EXPECT_EQ( http->GET( c_server_httpbun + "delay/2" ).deadline( std::chrono::steady_clock::now() + 500ms ).exec().get_code(), CURLE_OPERATION_TIMEDOUT );
+    auto duration_ns = uv_hrtime() - start;
+    EXPECT_GT( duration_ns, 450'000'000 );
+    EXPECT_LT( duration_ns, 900'000'000 );
+    //
+    EXPECT_EQ( http->GET( c_server_httpbun + "delay/1" ).exec().get_code(), 200 );
+  }
+  //
+  // No reattempt past the deadline
+  {
+    auto start = uv_hrtime();
+    EXPECT_EQ( http->GET( "http://localhost:9999/" )
+                   .maximum_retries( 10, 200 )
+                   .deadline( std::chrono::steady_clock::now() + 700ms )
+                   .exec()
+                   .get_code(),
+               CURLE_COULDNT_CONNECT );
+    EXPECT_LT( uv_hrtime() - start, 900'000'000 );
+  }
+  //
+  // Expired while waiting in a host limiter
+  {
+    auto first = HTTP::create( async );
+    first->GET( c_server_httpbun + "delay/1" ).start();
+    //
+    auto start = uv_hrtime();
+    EXPECT_EQ( http->GET( c_server_httpbun + "get" ).deadline( std::chrono::steady_clock::now() + 300ms ).exec().get_code(), c_error_deadline );
+    EXPECT_LT( uv_hrtime() - start, 700'000'000 );
+    //
+    EXPECT_EQ( first->join().get_code(), 200 );
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// A slow request is duplicated, a single response is returned
+TEST( http_complex, hedge )
+{
+  using namespace std::chrono_literals;
+  //
+  ASync async;
+  async.start();
+  //
+  auto http = HTTP::create( async );
+  int  calls = 0;
+  //
+  // The primary request answers first, its 2 duplicates are aborted
+  http->GET( c_server_httpbun + "delay/1" ).hedge( 100ms, 2 ).start( [ & ]( const auto & ) { calls++; } );
+  EXPECT_EQ( http->join().get_code(), 200 );
+  EXPECT_EQ( http->get_body(), "OK" );
+  EXPECT_EQ( calls, 1 );
+  //
+  auto metrics = async.metrics();
+  EXPECT_EQ( metrics.requests_hedged   , 2 );
+  EXPECT_EQ( metrics.hedges_won        , 0 );
+  EXPECT_EQ( metrics.requests_completed, 1 );
+  //
+  // Fast enough: no duplicate
+  EXPECT_EQ( http->GET( c_server_httpbun + "get" ).hedge( 500ms ).exec().get_code(), 200 );
+  EXPECT_EQ( async.metrics().requests_hedged, 2 );
+  //
+  // Requests other than GET and HEAD, or sending a body, are not hedged
+  auto other = HTTP::create( async );
+  EXPECT_EQ( other->POST( c_server_httpbun + "delay/1" ).hedge( 10ms ).exec().get_code(), 200 );
+  EXPECT_EQ( other->GET ( c_server_httpbun + "delay/1" ).set_mime( { mime::parameter{ "m1", "40" } } ).hedge( 10ms ).exec().get_code(), 200 );
+  EXPECT_EQ( other->POST( c_server_httpbun + "post" ).set_body( "text/plain", "data" ).hedge( 0ms ).exec().get_code(), 200 );
+  EXPECT_EQ( async.metrics().requests_hedged, 2 );
+  //
+  // After the first quartile of the latency of the previous requests, the fast ones
+  EXPECT_EQ( http->GET( c_server_httpbun + "delay/1" ).hedge_percentile( 25 ).exec().get_code(), 200 );
+  EXPECT_EQ( async.metrics().requests_hedged, 3 );
+  //
+  EXPECT_EQ( http->GET( c_server_httpbun + "get" ).hedge_percentile( 200 ).exec().get_code(), c_error_options_set );
+  EXPECT_EQ( http->GET( c_server_httpbun + "get" ).hedge_percentile( 0 ).exec().get_code(), c_error_options_set );
+  //
+  async.stop();
+  //
+  // The duplicates respect the host limits: skipped while the only slot is taken
+  ASync limited;
+  EXPECT_TRUE( limited.set_host_limits( c_server_httpbun, { 0, 0, 1 } ) ); // 1 in flight
+  limited.start();
+  {
+    auto slow = HTTP::create( limited );
+    EXPECT_EQ( slow->GET( c_server_httpbun + "delay/1" ).hedge( 100ms, 2 ).exec().get_code(), 200 );
+    EXPECT_EQ( limited.metrics().requests_hedged, 0 );
+  }
+  limited.stop();
+  //
+  // A request waiting for its reattempt is not duplicated
+  ASync retrying;
+  retrying.start();
+  {
+    retry_policy policy;
+    policy.max_retries   = 2;
+    policy.base_delay_ms = 300;
+    policy.jitter        = 0;
+    //
+    auto failing = HTTP::create( retrying );
+    calls        = 0;
+    failing->GET( c_server_httpbun + "status/503" ).hedge( 100ms ).retry( policy ).start( [ & ]( const auto & ) { calls++; } );
+    EXPECT_EQ( failing->join().get_code(), 503 );
+    EXPECT_EQ( calls, 1 );
+    //
+    auto retried = retrying.metrics();
+    EXPECT_EQ( retried.requests_retried, 2 );
+    EXPECT_EQ( retried.requests_hedged , 0 );
+  }
+  retrying.stop();
+}
+
+//--------------------------------------------------------------------
+// Retry policy with backoff, and the retry budget limiting the reattempts
+TEST( http_complex, retry_policy )
+{
+  ASync async;
+  EXPECT_FALSE( async.set_retry_budget( -1 ) );
+  EXPECT_TRUE ( async.set_retry_budget( 0, 0, 3 ) ); // only 3 reattempts in total
+  async.start();
+  EXPECT_FALSE( async.set_retry_budget( 0.1 ) );    // already started
+  //
+  {
+    retry_policy policy;
+    policy.max_retries   = 2;
+    policy.base_delay_ms = 200;
+    policy.jitter        = 0;
+    //
+    auto start = uv_hrtime();
+    auto http  = HTTP::create( async );
+    auto code  = http->GET( "http://localhost:9999/" ).retry( policy ).exec().get_code();
+    //
+    EXPECT_EQ( code, CURLE_COULDNT_CONNECT );
+    EXPECT_GT( uv_hrtime() - start, 590'000'000 ); // 200ms + 400ms (leave a small margin)
+    //
+    policy.retryable = []( long p_code ) { return p_code == 500; };
+    code = http->GET( c_server_httpbun + "status/500" ).retry( policy ).exec().get_code();
+    EXPECT_EQ( code, 500 );
+    //
+    auto metrics = async.metrics();
+    EXPECT_EQ( metrics.requests_retried     , 3 );
+    EXPECT_EQ( metrics.requests_retry_denied, 1 ); // the budget is exhausted
+  }
+  //
+  async.stop();
+}
+
+//--------------------------------------------------------------------
+// A reattempt sends the request body again
+TEST( http_complex, retry_body )
+{
+  ASync async;
+  async.start();
+  //
+  {
+    retry_policy policy;
+    policy.max_retries   = 1;
+    policy.base_delay_ms = 10;
+    //
+    auto http = HTTP::create( async );
+    //
+    EXPECT_EQ( http->PUT( c_server_httpbun + "status/503" )
+                   .set_body( "text/plain", "0123456789" )
+                   .retry( policy )
+                   .exec()
+                   .get_code(),
+               503 );
+    EXPECT_EQ( http->PUT( c_server_httpbun + "status/503" )
+                   .set_body_file( "text/plain", PROJECT_ROOT_DIR "/tests/data.txt" )
+                   .retry( policy )
+                   .exec()
+                   .get_code(),
+               503 );
+    EXPECT_EQ( async.metrics().requests_retried, 2 );
+  }
+  //
+  async.stop();
+}
+
 //--------------------------------------------------------------------
 // Request continues and ASync is stopped
 TEST( http_complex, destructor_running )